@@ -51,6 +51,9 @@ cl %CommonCompilerFlags% %INCLUDES% %SOURCES% /Fe%OUT_DIR%/%OUT_BIN% /Fo%OUT_DIR
 %VULKAN_SDK%/bin/glslc -o %OUT_DIR%/simple.frag.spv simple.frag
 %VULKAN_SDK%/bin/glslc -o %OUT_DIR%/simple.vert.spv simple.vert
 
+@REM asset archive is repacked from the new shaders on the next run
+@IF EXIST %OUT_DIR%\assets.pak del %OUT_DIR%\assets.pak
+
 @REM --------------------------------------------------------------------------
 @REM Cleanup
 @REM --------------------------------------------------------------------------
@@ -15,7 +15,7 @@ S_OUT_DIR=./out
 S_INCLUDE_DIRECTORIES="-I$VULKAN_SDK/include"
 S_LINK_DIRECTORIES="-L$VULKAN_SDK/lib -L/usr/lib/x86_64-linux-gnu"
 S_COMPILE_FLAGS="-D_DEBUG -g"
-S_LINK_FLAGS="-lstdc++ -lvulkan -lxcb -lX11 -lX11-xcb -lxkbcommon"
+S_LINK_FLAGS="-lstdc++ -lpthread -lvulkan -lxcb -lX11 -lX11-xcb -lxkbcommon"
 S_SOURCES="main.cpp"
 
 if [ -d $S_OUT_DIR ]; then
@@ -26,6 +26,7 @@ fi
 
 glslc -o $S_OUT_DIR/simple.frag.spv simple.frag
 glslc -o $S_OUT_DIR/simple.vert.spv simple.vert
+rm -f $S_OUT_DIR/assets.pak # repacked from the new shaders on the next run
 
 # source ../scripts/semper_build.sh
 gcc $S_SOURCES --debug -std=c++17 $S_COMPILE_FLAGS $S_INCLUDE_DIRECTORIES $S_LINK_DIRECTORIES $S_LINK_FLAGS -o $S_OUT_DIR/$S_OUT_BIN
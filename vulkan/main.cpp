@@ -13,13 +13,32 @@
 //  [X] Index Buffers
 //  [X] Vertex Buffers
 //  [X] Depth Buffer
+//  [X] Transient Attachments (lazily allocated, aliased by lifetime otherwise)
 //  [X] Textures
-//  [X] Multiple Frames in Flight
+//  [X] Multiple Frames in Flight (frame context ring, count set at runtime)
+//  [X] Timeline Semaphores (frame retirement, upload completion, deferred destruction)
+//  [X] Present Mode Policy (low latency, no tearing, power saving, switched at runtime)
+//  [X] Resizing (swapchain recreated without waiting, old objects destroyed once unused)
+//  [X] Frame Pacing (VK_KHR_present_wait, input to photon latency)
+//  [X] Job System (work stealing, counters)
+//  [X] Multithreaded Recording (secondary command buffers)
+//  [X] Command Buffer Replay (re-recorded only when invalidated)
+//  [X] Linear Arenas (setup, per-frame and per-thread scratch)
+//  [X] Device Memory Sub-allocation
+//  [X] Usage Driven Memory Placement (ReBAR/UMA aware)
+//  [X] Staging Ring
+//  [X] Batched Uploads
+//  [X] Constant Buffers (per-frame dynamic uniform arena)
+//  [X] Descriptor Caching (sets keyed by content hash, written through update templates)
+//  [X] Bindless Textures (descriptor indexing, texture table indexed by push constants)
+//  [X] Dedicated Transfer Queue
+//  [X] Texture Streaming
+//  [X] Asset Archive
+//  [X] Residency Management (VK_EXT_memory_budget, LRU eviction/demotion)
+//  [X] Compressed Textures (KTX2, BCn/ETC2/ASTC with cpu decode fallback)
+//  [X] Mipmapping (blit chain, cpu box filter fallback)
 // Missing features:
 //  [ ] Platform: MacOs
-//  [ ] Constant Buffers
-//  [ ] Mipmapping
-//  [ ] Resizing
 //  [ ] Multiple draw calls
 //  [ ] Multiple render targets
 // Important:
@@ -50,6 +69,55 @@ Index of this file:
 // [SECTION] options
 //-----------------------------------------------------------------------------
 #define MV_ENABLE_VALIDATION_LAYERS
+#define S_FRAMES_IN_FLIGHT 2u         // default, PL_FRAMES_IN_FLIGHT overrides it at runtime
+#define S_MAX_FRAMES_IN_FLIGHT 3u
+#define S_DESCRIPTORS_PER_FRAME 256u  // of each type, in a frame's descriptor pool
+#define S_DESCRIPTOR_CACHE_SIZE 64u   // sets per frame in flight keyed by their contents, power of 2
+#define S_DESCRIPTOR_CACHE_PROBES 8u  // slots searched before the home slot is rewritten
+#define S_TEXTURE_TABLE_SIZE 1024u     // sampled images in the bindless table, must match simple.frag
+#define S_TEXTURE_TABLE_SAMPLERS 16u   // samplers in the bindless table, must match simple.frag
+#define S_LOG_FRAME_TIMES 0           // average frame time and time blocked on the gpu/present
+#define S_FRAME_TIME_WINDOW 256u      // frames averaged by S_LOG_FRAME_TIMES
+#define S_PRESENT_POLICY PRESENT_POLICY_NO_TEARING // default, PL_PRESENT_POLICY overrides it at runtime and P cycles through them
+#define S_SWAPCHAIN_ARENA_SIZE 1024u*4u // per image arrays, reset when the swapchain is rebuilt
+#define S_PRESENT_LATENCY 2u          // frames recorded ahead of the last completed present, PL_PRESENT_LATENCY overrides it, 0 disables pacing
+#define S_MAX_PRESENT_LATENCY 4u
+#define S_PRESENT_WAIT_TIMEOUT 100000000ull // ns, a present that takes longer doesn't hold the frame back
+#define S_LOG_INPUT_LATENCY 1         // time from an input event to the present of the first frame that consumed it
+#define S_SETUP_ARENA_SIZE 1024u*256u
+#define S_FRAME_ARENA_SIZE 1024u*256u // per frame in flight
+#define S_SCRATCH_ARENA_SIZE 1024u*64u // per thread
+#define S_ASSERT_NO_FRAME_ALLOCATIONS 0 // assert the main loop stops calling malloc after S_WARMUP_FRAMES
+#define S_WARMUP_FRAMES 64u
+#define S_MAX_JOB_THREADS 8u         // including the main thread, capped by the core count
+#define S_JOB_QUEUE_SIZE 1024u       // per thread, jobs pushed to a full queue run inline
+#define S_JOB_SPIN_COUNT 64u         // failed steal attempts before a job thread sleeps
+#define S_JOB_BENCHMARK 0            // print job throughput and latency at startup
+#define S_MAX_STARTUP_STEPS 32u
+#define S_MAX_STARTUP_DEPENDENCIES 4u
+#define S_LOG_STARTUP_TIMINGS 1      // per step timings and the critical path of the startup graph
+#define S_MIN_DRAWS_PER_RECORDER 256u // fewer draws aren't worth another recording job
+#define S_DRAW_COUNT 1u               // copies of the quad drawn each frame, raise to load the recorders
+#define S_STATIC_COMMAND_BUFFERS 1    // replay the render pass contents until something they bind changes
+#define S_DEVICE_MEMORY_BLOCK_SIZE 64u*1024u*1024u
+#define S_REBAR_MIN_HEAP_SIZE 1024ull*1024u*1024u // smaller host visible device local heaps are the legacy 256MB BAR
+#define S_LOG_MEMORY_PLACEMENT 1
+#define S_STAGING_RING_SIZE 1024u*1024u*4u
+#define S_STAGING_RING_RETIREMENTS 64u
+#define S_UNIFORM_ARENA_SIZE 1024u*256u // per frame in flight
+#define S_USE_TRANSFER_QUEUE 1          // upload through a transfer only queue family if there is one
+#define S_MAX_MIP_LEVELS 16u
+#define S_MAX_TRANSIENT_ATTACHMENTS 8u
+#define S_STREAMING_QUEUE_SIZE 64u
+#define S_STREAMING_BUDGET 1024u*1024u*2u // texture bytes uploaded per frame
+#define S_RESIDENCY_BUDGET_PERCENT 80u // of the heap size when VK_EXT_memory_budget isn't available
+#define S_RESIDENCY_HIGH_WATERMARK 90u // percent of the budget that triggers eviction/demotion
+#define S_RESIDENCY_IDLE_FRAMES 120u   // unused this long, textures are evicted instead of demoted
+#define S_STREAMED_TEXTURE "texture"      // base name, replaces the 2x2 placeholder once it streams in (see streaming_thread_main)
+#define S_ARCHIVE_FILE "assets.pak"         // packed from the loose files on first run
+#define S_ARCHIVE_MAGIC 0x4B415053u         // "SPAK"
+#define S_ARCHIVE_VERSION 1u
+#define S_ARCHIVE_ALIGNMENT 256u            // blob alignment in the archive (>= optimalBufferCopyOffsetAlignment)
 
 //-----------------------------------------------------------------------------
 // [SECTION] header mess
@@ -66,12 +134,26 @@ Index of this file:
 #include <X11/XKBlib.h>  // sudo apt-get install libx11-dev
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>  // sudo apt-get install libxkbcommon-x11-dev libx11-xcb-dev
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <set> // temporary
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define S_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #if defined(_WIN32)
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -84,6 +166,14 @@ Index of this file:
 #include <assert.h>
 #define S_VULKAN(x) assert(x == VK_SUCCESS)
 
+// counted per thread, see S_ASSERT_NO_FRAME_ALLOCATIONS
+#define S_ALLOC(size) (g_heapAllocationCount++, malloc(size))
+#define S_REALLOC(ptr, size) (g_heapAllocationCount++, realloc(ptr, size))
+#define S_CALLOC(count, size) (g_heapAllocationCount++, calloc(count, size))
+
+// node of the startup graph, dependencies are other steps' functions (see run_startup_graph)
+#define S_STARTUP_STEP(function, ...) { #function, function, { __VA_ARGS__ } }
+
 //-----------------------------------------------------------------------------
 // [SECTION] platform specific variables
 //-----------------------------------------------------------------------------
@@ -102,11 +192,372 @@ static xcb_atom_t        g_wm_delete_win;
 //-----------------------------------------------------------------------------
 // [SECTION] general variables
 //-----------------------------------------------------------------------------
+struct ArenaBlock // followed by the block's memory
+{
+    ArenaBlock* previous;
+    size_t      size;
+    size_t      used;
+};
+
+struct LinearArena // bump allocator, released all at once by arena_reset
+{
+    ArenaBlock* block;     // current, older blocks are merged into one on reset
+    size_t      blockSize; // minimum size of a new block
+    std::mutex* mutex;     // locked by arena_alloc if the arena is shared between threads
+};
+
+struct ArenaMark // arena position to rewind scratch allocations to
+{
+    ArenaBlock* block;
+    size_t      used;
+};
+
+struct DeviceMemoryRange
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    bool         free;
+    bool         linear; // buffers & linear images (bufferImageGranularity)
+};
+
+struct DeviceMemoryBlock
+{
+    VkDeviceMemory     memory;
+    VkDeviceSize       size;
+    VkDeviceSize       usedSize;
+    char*              mapping; // persistently mapped if host visible
+    DeviceMemoryRange* ranges;  // sorted by offset, covers the whole block
+    unsigned           rangeCount;
+    unsigned           rangeCapacity;
+    bool               dedicated;
+};
+
+struct DeviceMemoryHeap // blocks of a single memory type
+{
+    DeviceMemoryBlock* blocks;
+    unsigned           blockCount;
+    unsigned           blockCapacity;
+};
+
+enum MemoryUsage // picks the memory type, see find_memory_type
+{
+    MEMORY_USAGE_GPU_ONLY, // images and attachments, never touched by the cpu
+    MEMORY_USAGE_STATIC,   // written once by the cpu (directly on ReBAR/UMA, staged otherwise), read by the gpu
+    MEMORY_USAGE_DYNAMIC,  // rewritten by the cpu every frame
+    MEMORY_USAGE_UPLOAD,   // staging, cpu writes and the gpu copies from
+    MEMORY_USAGE_READBACK, // gpu writes and the cpu reads
+    MEMORY_USAGE_TRANSIENT, // attachments that never leave the render pass, lazily allocated on tilers
+    MEMORY_USAGE_COUNT
+};
+
+struct DeviceAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize   offset;
+    VkDeviceSize   size;
+    char*          mapping; // nullptr unless host visible
+    unsigned       memoryType;
+    unsigned       block;
+};
+
+struct TransientAttachment // render pass only attachment, see create_transient_attachments
+{
+    VkFormat              format;
+    VkImageUsageFlags     usage;     // TRANSIENT_ATTACHMENT is added
+    VkImageAspectFlags    aspect;
+    VkSampleCountFlagBits samples;
+    unsigned              firstPass; // lifetime in render pass order, attachments whose
+    unsigned              lastPass;  // lifetimes don't overlap share memory
+    VkImage               image;
+    VkImageView           view;
+    VkDeviceSize          offset;    // into g_transientAllocation
+};
+
+typedef void (*JobFunction)(void* data, unsigned index);
+
+struct JobCounter // jobs still running, see run_jobs and wait_for_counter
+{
+    std::atomic<unsigned> value{0u};
+};
+
+struct Job
+{
+    JobFunction function;
+    void*       data;
+    unsigned    index; // of the job within its run_jobs call
+    JobCounter* counter;
+};
+
+struct JobQueue // one per job thread: the owner takes the newest job, thieves the oldest
+{
+    std::mutex mutex;
+    Job        jobs[S_JOB_QUEUE_SIZE]; // ring buffer
+    unsigned   head;                   // oldest job
+    unsigned   count;
+};
+
+struct StartupStep
+{
+    const char* name;
+    void      (*function)();
+    void      (*dependencies[S_MAX_STARTUP_DEPENDENCIES])(); // steps that have to finish first
+};
+
+struct StartupStepState // see run_startup_graph
+{
+    const StartupStep*    step;
+    unsigned              dependencies[S_MAX_STARTUP_DEPENDENCIES]; // into g_startupSteps
+    unsigned              dependencyCount;
+    std::atomic<unsigned> remainingDependencies; // the step is queued once this hits 0
+    double                start;                 // ms since the graph started
+    double                end;
+    unsigned              thread;                // g_jobThreadIndex it ran on
+};
+
+struct RecordingContext // one per recording job and frame in flight
+{
+    VkCommandPool   commandPool;   // reset as a whole when the frame records again
+    VkCommandBuffer commandBuffer; // secondary, executed by the frame's render pass
+};
+
+struct RenderPassContents // secondary command buffers of a frame in flight, see record_render_pass_contents
+{
+    unsigned recorderCount; // buffers recorded, 0 once invalidated
+    uint32_t dynamicOffset; // uniform arena offset baked into them
+};
+
+enum PresentPolicy // picks the present mode, see choose_present_mode
+{
+    PRESENT_POLICY_LOW_LATENCY,  // uncapped and may tear, for benchmarks
+    PRESENT_POLICY_NO_TEARING,   // uncapped, the newest finished frame replaces queued ones
+    PRESENT_POLICY_POWER_SAVING, // vsync, frames queue up behind the display
+    PRESENT_POLICY_COUNT
+};
+
+struct Timeline // timeline semaphore, signaled with increasing values by one stream of submissions
+{
+    VkSemaphore semaphore;
+    uint64_t    value;     // signaled by the last submission
+    uint64_t    completed; // last value read back, polling below it doesn't call into the driver
+};
+
+struct StagingRetirement
+{
+    VkDeviceSize end;      // ring position that becomes free once value is reached
+    Timeline*    timeline;
+    uint64_t     value;
+};
+
+struct UniformArena // one region per frame in flight, bound as UNIFORM_BUFFER_DYNAMIC
+{
+    VkBuffer         buffer;
+    DeviceAllocation allocation; // persistently mapped
+    VkDeviceSize     frameSize;
+    VkDeviceSize     alignment;  // minUniformBufferOffsetAlignment
+    VkDeviceSize     frameBase;  // start of the current frame's region
+    VkDeviceSize     head;
+    bool             coherent;
+};
+
+struct PendingSubmission // command buffer kept alive until g_transferTimeline reaches value
+{
+    VkCommandBuffer commandBuffer;
+    uint64_t        value;
+};
+
+struct MipGeneration // blit chain recorded on the graphics queue once level 0 is acquired
+{
+    VkImage  image;
+    unsigned width;
+    unsigned height;
+    unsigned mipLevels;
+};
+
+struct AcquireBarriers // queue family ownership acquires still to be recorded on the graphics queue
+{
+    VkImageMemoryBarrier*  images;
+    VkBufferMemoryBarrier* buffers;
+    unsigned               imageCount;
+    unsigned               imageCapacity;
+    unsigned               bufferCount;
+    unsigned               bufferCapacity;
+    MipGeneration*         mips;
+    unsigned               mipCount;
+    unsigned               mipCapacity;
+    VkPipelineStageFlags   dstStageMask;
+    LinearArena*           arena; // backs the arrays, heap if nullptr
+};
+
+struct SemaphoreWaits
+{
+    VkSemaphore*          semaphores;
+    VkPipelineStageFlags* stageMasks;
+    uint64_t*             values;     // ignored for binary semaphores
+    unsigned              count;
+    unsigned              capacity;
+};
+
+struct UploadBatch
+{
+    VkCommandBuffer commandBuffer; // VK_NULL_HANDLE once submitted
+    AcquireBarriers acquires;
+    unsigned        commandCount;  // commands recorded since the last submit
+    uint64_t        timelineValue; // g_transferTimeline value of its last submission
+};
+
+struct DescriptorCache // sets keyed by a hash of what was last written to them, unchanged contents aren't rewritten
+{
+    VkDescriptorSet*       sets;    // [S_DESCRIPTOR_CACHE_SIZE], allocated from the frame's pool on first use
+    VkDescriptorSetLayout* layouts; // of each set
+    uint64_t*              hashes;  // of each set's contents, 0 if the slot is empty
+};
+
+struct FrameContext // owned by one frame in flight, reused once g_graphicsTimeline reaches its value (see begin_frame)
+{
+    VkCommandPool      commandPool;        // reset as a whole
+    VkCommandBuffer    commandBuffer;      // primary
+    VkDescriptorPool   descriptorPool;     // sets only this frame binds
+    DescriptorCache    descriptorCache;    // from descriptorPool
+    uint64_t           timelineValue;      // g_graphicsTimeline value signaled by its last submission
+    VkSemaphore        imageAvailable;
+    VkSemaphore        renderFinished;
+    SemaphoreWaits     waits;              // [0] is image available, then g_transferTimeline if it acquires uploads
+    LinearArena        arena;              // upload batch arrays, reset with the frame
+    RecordingContext*  recordingContexts;  // [recorder], g_jobThreadCount of them
+    RenderPassContents renderPassContents;
+};
+
+enum StreamState
+{
+    STREAM_STATE_QUEUED,   // waiting for/being loaded by the streaming thread
+    STREAM_STATE_LOADED,   // pixels ready, levels being uploaded
+    STREAM_STATE_RESIDENT, // all levels uploaded
+    STREAM_STATE_EVICTED,  // released to stay within the memory budget, streamed again once used
+    STREAM_STATE_FAILED
+};
+
+struct FileView // read only memory mapping of a whole file
+{
+    const unsigned char* data;
+    size_t               size;
+#ifdef _WIN32
+    HANDLE               file;
+    HANDLE               mapping;
+#endif
+};
+
+struct Ktx2Info
+{
+    VkFormat             format;
+    unsigned             width;
+    unsigned             height;
+    unsigned             mipLevels;
+    const unsigned char* levels[S_MAX_MIP_LEVELS]; // into the mapped file, level 0 first
+};
+
+struct StreamedTexture
+{
+    char             path[256];
+    std::atomic<int> state;
+    unsigned         width;
+    unsigned         height;
+    unsigned         mipLevels;
+    VkFormat         format;
+    const unsigned char* levels[S_MAX_MIP_LEVELS]; // into file or pixels
+    FileView         file;          // kept mapped while levels are uploaded from it
+    unsigned char*   pixels;        // decoded levels (TGA or cpu decoded KTX2), freed once resident
+    VkImage          image;
+    DeviceAllocation allocation;
+    VkImageView      view;          // covers residentLevel to the last level
+    unsigned         textureIndex;  // of view in g_textureTable
+    unsigned         residentLevel; // most detailed level that can be sampled
+    unsigned         uploadLevel;   // most detailed level uploaded or in flight
+    UploadBatch      batch;
+    bool             uploading;
+    size_t           lastUsedFrame; // g_frameIndex when last drawn with
+};
+
+enum ArchiveEntryType
+{
+    ARCHIVE_ENTRY_SHADER,      // SPIR-V
+    ARCHIVE_ENTRY_VERTEX_DATA,
+    ARCHIVE_ENTRY_INDEX_DATA,
+    ARCHIVE_ENTRY_TEXTURE      // all levels, upload ready
+};
+
+struct ArchiveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount; // table of contents follows the header
+    uint32_t reserved;
+};
+
+struct ArchiveEntry
+{
+    char     name[56];
+    uint32_t type;
+    uint32_t format;    // VkFormat of texture entries
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t reserved;
+    uint64_t offset;    // from the start of the file
+    uint64_t size;
+};
+
+struct AssetArchive
+{
+    FileView            file; // mapped for the lifetime of the application
+    const ArchiveEntry* entries;
+    unsigned            entryCount;
+};
+
+struct DeferredHandle // see process_deferred_destruction for the supported types
+{
+    VkObjectType type;
+    uint64_t     handle;
+    uint64_t     value; // g_graphicsTimeline value of the last frame that could use it
+};
+
+struct TextureTable // one global set, partially bound and updated after bind, draws index into it
+{
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool      pool;
+    VkDescriptorSet       set;
+    unsigned              textureCount;   // slots handed out so far, free slots are reused first
+    unsigned              samplerCount;
+    unsigned*             freeSlots;      // released slots, reusable once g_graphicsTimeline reaches their value
+    uint64_t*             freeValues;
+    unsigned              freeCount;
+};
+
+struct DeferredImage
+{
+    VkImage          image;
+    DeviceAllocation allocation;
+    uint64_t         value; // g_graphicsTimeline value of the last frame that could use it
+};
+
+struct StagingRing
+{
+    VkBuffer          buffer;
+    DeviceAllocation  allocation; // persistently mapped
+    VkDeviceSize      size;
+    VkDeviceSize      head;       // monotonic write position
+    VkDeviceSize      tail;       // monotonic position of oldest in-flight byte
+    VkDeviceSize      retiredHead;
+    StagingRetirement retirements[S_STAGING_RING_RETIREMENTS];
+    unsigned          retirementStart;
+    unsigned          retirementCount;
+};
+
 static const char*                      g_validationLayers[] = {"VK_LAYER_KHRONOS_validation"};
 static const char*                      g_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 static int                              g_width = 1024;
 static int                              g_height = 768;
 static bool                             g_windowResized = false;
+static bool                             g_swapChainOutOfDate = false; // acquire or present said so, see recreate_swapchain
 static VkInstance                       g_instance;
 static VkSurfaceKHR                     g_surface;
 static VkDebugUtilsMessengerEXT         g_debugMessenger;
@@ -114,41 +565,107 @@ static VkPhysicalDeviceProperties       g_deviceProperties;
 static VkPhysicalDeviceMemoryProperties g_memoryProperties;
 static VkPhysicalDevice                 g_physicalDevice;
 static unsigned                         g_graphicsQueueFamily;
+static unsigned                         g_transferQueueFamily; // same as graphics without a dedicated transfer family
 static VkDevice                         g_logicalDevice;
 static VkQueue                          g_graphicsQueue;
 static VkQueue                          g_presentQueue;
+static VkQueue                          g_transferQueue;
 static unsigned                         g_minImageCount;
-static unsigned                         g_framesInFlight;
+static unsigned                         g_framesInFlight;           // see select_frames_in_flight
+static PresentPolicy                    g_presentPolicy;            // see select_present_policy
+static bool                             g_presentPolicyChanged = false; // swapchain is rebuilt before the next frame
+static VkPresentModeKHR                 g_presentMode;
 static VkSwapchainKHR                   g_swapChain;
 static VkImage*                         g_swapChainImages;
 static VkImageView*                     g_swapChainImageViews;
 static VkFormat                         g_swapChainImageFormat;
 static VkExtent2D                       g_swapChainExtent;
 static VkCommandPool                    g_commandPool;
-static VkCommandBuffer*                 g_commandBuffers;
-static VkDescriptorPool                 g_descriptorPool;
+static VkCommandPool                    g_transferCommandPool;
+static FrameContext*                    g_frameContexts;            // ring of g_framesInFlight, g_currentFrame records
 static VkRenderPass                     g_renderPass;
-static VkImage                          g_depthImage;
-static VkDeviceMemory                   g_depthImageMemory;
+static VkImage                          g_depthImage;     // transient attachment
 static VkImageView                      g_depthImageView;
+static unsigned                         g_depthAttachment; // into g_transientAttachments
+static TransientAttachment              g_transientAttachments[S_MAX_TRANSIENT_ATTACHMENTS];
+static unsigned                         g_transientAttachmentCount = 0u;
+static DeviceAllocation                 g_transientAllocation; // backs all transient attachments
 static VkFramebuffer*                   g_swapChainFramebuffers;
-static VkSemaphore*                     g_imageAvailableSemaphores; // syncronize rendering to image when already rendering to image
-static VkSemaphore*                     g_renderFinishedSemaphores; // syncronize render/present
-static VkFence*                         g_inFlightFences;
-static VkFence*                         g_imagesInFlight;
+static uint64_t*                        g_imageTimelineValues;      // per swapchain image, g_graphicsTimeline value of the last frame rendering to it
 static unsigned                         g_currentImageIndex = 0;
 static size_t                           g_currentFrame = 0;
-static VkViewport                       g_viewport;
 static bool                             g_running=true;
+static thread_local size_t              g_heapAllocationCount = 0u; // S_ALLOC/S_REALLOC/S_CALLOC calls on this thread
+static JobQueue                         g_jobQueues[S_MAX_JOB_THREADS]; // [0] belongs to the main thread
+static std::thread                      g_jobThreads[S_MAX_JOB_THREADS];
+static unsigned                         g_jobThreadCount = 1u;      // including the main thread
+static thread_local unsigned            g_jobThreadIndex = 0u;
+static std::mutex                       g_jobMutex;                 // sleeping job threads
+static std::condition_variable          g_jobCondition;
+static std::atomic<unsigned>            g_jobQueuedCount{0u};       // over all queues
+static std::atomic<unsigned>            g_jobSleeperCount{0u};
+static bool                             g_jobStop = false;
+static unsigned                         g_recorderCount;            // recording jobs of the current frame
+static StartupStepState                 g_startupSteps[S_MAX_STARTUP_STEPS];
+static unsigned                         g_startupStepCount = 0u;
+static unsigned                         g_startupOrder[S_MAX_STARTUP_STEPS]; // steps in the order they finished
+static std::atomic<unsigned>            g_startupFinishedCount{0u};
+static JobCounter                       g_startupCounter;
+static double                           g_startupBegin;             // get_time_ms()
+static std::mutex                       g_setupArenaMutex;          // setup steps run in parallel
+static LinearArena                      g_setupArena = { nullptr, S_SETUP_ARENA_SIZE, &g_setupArenaMutex }; // lives until cleanup
+static LinearArena                      g_swapChainArena = { nullptr, S_SWAPCHAIN_ARENA_SIZE }; // per image arrays, see recreate_swapchain
+static thread_local LinearArena         g_scratchArena = { nullptr, S_SCRATCH_ARENA_SIZE }; // function local, rewound with arena_rewind
+static DeviceMemoryHeap                 g_deviceMemoryHeaps[VK_MAX_MEMORY_TYPES];
+static unsigned                         g_deviceMemoryBlockCount = 0u; // live vkAllocateMemory calls
+static std::mutex                       g_deviceMemoryMutex;        // guards the heaps, setup steps allocate in parallel
+static StagingRing                      g_stagingRing;
+static Timeline                         g_graphicsTimeline;         // signaled once per frame, value is the number of frames submitted
+static Timeline                         g_transferTimeline;         // signaled by every upload submission, on g_transferQueue
+static PendingSubmission*               g_pendingSubmissions;
+static unsigned                         g_pendingSubmissionCount = 0u;
+static unsigned                         g_pendingSubmissionCapacity = 0u;
+static AcquireBarriers                  g_pendingAcquires;          // submitted uploads not yet acquired by a frame
+static uint64_t                         g_pendingAcquireValue = 0u; // g_transferTimeline value the pending acquires wait for
+static UploadBatch                      g_setupUploads;
+static size_t                           g_frameIndex = 0u;          // frames submitted so far
+static DeferredHandle*                  g_deferredHandles;
+static unsigned                         g_deferredHandleCount = 0u;
+static unsigned                         g_deferredHandleCapacity = 0u;
+static TextureTable                     g_textureTable;
+static DeferredImage*                   g_deferredImages;
+static unsigned                         g_deferredImageCount = 0u;
+static unsigned                         g_deferredImageCapacity = 0u;
+static bool                             g_memoryBudgetSupported = false; // VK_EXT_memory_budget
+static bool                             g_presentWaitSupported = false;  // VK_KHR_present_id + VK_KHR_present_wait
+static PFN_vkWaitForPresentKHR          g_vkWaitForPresentKHR;
+static unsigned                         g_presentLatency;           // see select_present_policy and pace_frame
+static uint64_t                         g_swapChainFirstPresentId = 1u; // present ids below it went to a retired swapchain
+static uint64_t                         g_pacedPresentId = 0u;      // last present pace_frame waited for
+static double                           g_pendingInputTime = 0.0;   // get_time_ms() of the oldest input no frame consumed yet, 0 if none
+static double                           g_presentInputTimes[S_MAX_PRESENT_LATENCY]; // [present id % S_MAX_PRESENT_LATENCY], input consumed by the frame
+static VkDeviceSize                     g_heapBudgets[VK_MAX_MEMORY_HEAPS];
+static VkDeviceSize                     g_heapUsages[VK_MAX_MEMORY_HEAPS];       // minus space the allocator can reuse
+static VkDeviceSize                     g_heapPendingFrees[VK_MAX_MEMORY_HEAPS]; // deferred frees not done yet
+static StreamedTexture**                g_residentTextures;                      // every streamed texture, eviction candidates
+static unsigned                         g_residentTextureCount = 0u;
+static unsigned                         g_residentTextureCapacity = 0u;
+static std::thread                      g_streamingThread;
+static std::mutex                       g_streamingMutex;
+static std::condition_variable          g_streamingCondition;
+static StreamedTexture*                 g_streamingQueue[S_STREAMING_QUEUE_SIZE];
+static unsigned                         g_streamingQueueCount = 0u;
+static bool                             g_streamingStop = false;
+static UniformArena                     g_uniformArena;
 
 //-----------------------------------------------------------------------------
 // [SECTION] example specific variables
 //-----------------------------------------------------------------------------
 static VkBuffer                          g_indexBuffer;
 static VkBuffer                          g_vertexBuffer;
-static VkDeviceMemory                    g_indexDeviceMemory;
-static VkDeviceMemory                    g_vertexDeviceMemory;
-static VkDeviceMemory                    g_textureImageMemory;
+static DeviceAllocation                  g_indexAllocation;
+static DeviceAllocation                  g_vertexAllocation;
+static DeviceAllocation                  g_textureImageAllocation;
 static VkPipelineLayout                  g_pipelineLayout;
 static VkPipeline                        g_pipeline;
 static VkVertexInputAttributeDescription g_attributeDescriptions[2];
@@ -156,10 +673,15 @@ static VkVertexInputBindingDescription   g_bindingDescriptions[1];
 static VkShaderModule                    g_vertexShaderModule;
 static VkShaderModule                    g_pixelShaderModule;
 static VkImage                           g_textureImage;
-static VkDescriptorImageInfo             g_imageInfo;
+static VkImageView                       g_textureImageView; // placeholder while g_streamedTexture isn't resident
+static VkSampler                         g_textureSampler;
+static unsigned                          g_textureIndex;  // of g_textureImageView in g_textureTable
 static VkDescriptorSetLayout             g_descriptorSetLayout;
-static VkDescriptorSet*                  g_descriptorSets;
+static VkDescriptorSet*                  g_descriptorSets;         // per frame in flight, bound by its render pass contents
+static VkDescriptorUpdateTemplate        g_descriptorUpdateTemplate; // writes a FrameDescriptors
 static VkWriteDescriptorSet              g_descriptor;
+static StreamedTexture                   g_streamedTexture;
+static AssetArchive                      g_assetArchive;
 
 //-----------------------------------------------------------------------------
 // [SECTION] example specific data
@@ -190,34 +712,66 @@ static unsigned char g_image[] = {
     255,   0, 255, 255
 };
 
+struct FrameDescriptors // set 1, laid out for g_descriptorUpdateTemplate, hashed as a whole
+{
+    VkDescriptorBufferInfo constants; // binding 0, dynamic
+};
+
+struct DrawConstants // per draw, pushed
+{
+    unsigned textureIndex; // into g_textureTable
+    unsigned samplerIndex;
+};
+
 static ConstantBuffer g_vertexOffset = { 0.0f, 0.0f };
+static unsigned       g_vertexOffsetDynamicOffset = 0u; // into g_uniformArena, this frame
+static DrawConstants  g_drawConstants = { 0u, 0u };     // the quad's material
 
 //-----------------------------------------------------------------------------
 // [SECTION] general setup function declarations
 //-----------------------------------------------------------------------------
 static void create_window();
+static void select_frames_in_flight();
+static void select_present_policy();
 static void create_vulkan_instance();
 static void enable_validation_layers();
 static void create_surface();
 static void select_physical_device();
 static void create_logical_device();
+static void create_timelines();
 static void create_swapchain();
 static void create_command_pool();
-static void create_main_command_buffers();
-static void create_descriptor_pool();
+static void create_staging_ring();
+static void create_uniform_arena();
+static void create_texture_streamer();
+static void create_job_system();
+#if S_JOB_BENCHMARK
+static void run_job_benchmark();
+#endif
+static void run_startup_graph(const StartupStep* steps, unsigned count); // runs the steps as jobs, in dependency order
+static void create_frame_contexts();
+static void create_texture_table();
 static void create_render_pass();
 static void create_depth_resources();
+static unsigned add_transient_attachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkSampleCountFlagBits samples, unsigned firstPass, unsigned lastPass);
+static void create_transient_attachments();
 static void create_frame_buffers();
-static void create_syncronization_primitives();
+static bool recreate_swapchain(); // false while the window is minimized
+static void print_device_memory_stats();
+static UploadBatch begin_upload_batch(LinearArena& arena);
+static void submit_upload_batch(UploadBatch& batch);
+static void begin_setup_uploads();  // g_setupUploads
+static void submit_setup_uploads();
 static void process_events();
 static void cleanup();
 
 //-----------------------------------------------------------------------------
 // [SECTION] example specific setup function declarations
 //-----------------------------------------------------------------------------
+static void create_asset_archive();
 static void create_vertex_layout();
 static void create_descriptor_set_layout();
-static void create_descriptor_set();
+static void create_descriptor_template();
 static void create_pipeline_layout();
 static void create_pipeline();
 static void create_vertex_buffer();
@@ -227,10 +781,14 @@ static void create_texture();
 //-----------------------------------------------------------------------------
 // [SECTION] general per-frame function declarations
 //-----------------------------------------------------------------------------
-static void begin_frame(); // wait for fences and acquire next image
+static bool begin_frame(); // wait for the frame's timeline value and acquire next image, false if there's none
 static void begin_recording();
+static void update_residency(); // evicts/demotes textures when over the memory budget
 static void begin_render_pass();
-static void set_viewport_settings();
+static void record_render_pass_contents(); // secondary command buffers, in parallel
+static void invalidate_render_pass_contents(unsigned frame); // recorded again when the frame in flight comes around
+static void cycle_present_policy(); // the swapchain is rebuilt before the next frame
+static void note_input_event();     // starts the input to photon latency of the next frame
 static void end_render_pass();
 static void end_recording();
 static void submit_command_buffers_then_present();
@@ -239,8 +797,10 @@ static void submit_command_buffers_then_present();
 // [SECTION] example specific per-frame function declarations
 //-----------------------------------------------------------------------------
 static void update_descriptor_sets();
-static void setup_pipeline_state();
-static void draw();
+static void update_constant_buffers();
+static void set_viewport_settings(VkCommandBuffer commandBuffer);
+static void setup_pipeline_state(VkCommandBuffer commandBuffer);
+static void draw(VkCommandBuffer commandBuffer, unsigned firstDraw, unsigned drawCount);
 
 //-----------------------------------------------------------------------------
 // [SECTION] entry point
@@ -250,51 +810,82 @@ int main()
 
     // general setup
     create_window();
-    create_vulkan_instance();
-    enable_validation_layers();
-    create_surface();
-    select_physical_device();
-    create_logical_device();
-    create_swapchain();
-    create_command_pool();
-    create_main_command_buffers();
-    create_descriptor_pool();
-    create_render_pass();
-    create_depth_resources();
-    create_frame_buffers();
-    create_syncronization_primitives();
-
-    // example specific setup
-    create_vertex_layout();
-    create_descriptor_set_layout();
-    create_descriptor_set();
-    create_pipeline_layout();
-    create_pipeline();
-    create_vertex_buffer();
-    create_index_buffer();
-    create_texture();
+    create_job_system();
+#if S_JOB_BENCHMARK
+    run_job_benchmark();
+#endif
+
+    // the rest of the setup runs on the job threads, each step as soon as the steps it
+    // depends on are done. Steps recording into g_setupUploads are chained, as they share
+    // the batch's command buffer
+    static const StartupStep startupSteps[] =
+    {
+        // general setup
+        S_STARTUP_STEP(select_frames_in_flight),
+        S_STARTUP_STEP(select_present_policy),
+        S_STARTUP_STEP(create_vulkan_instance),
+        S_STARTUP_STEP(enable_validation_layers,     create_vulkan_instance),
+        S_STARTUP_STEP(create_surface,               create_vulkan_instance),
+        S_STARTUP_STEP(select_physical_device,       create_surface),
+        S_STARTUP_STEP(create_logical_device,        select_physical_device),
+        S_STARTUP_STEP(create_timelines,             create_logical_device),
+        S_STARTUP_STEP(create_swapchain,             create_logical_device, select_frames_in_flight, select_present_policy),
+        S_STARTUP_STEP(create_frame_contexts,        create_logical_device, select_frames_in_flight),
+        S_STARTUP_STEP(create_texture_table,         create_logical_device),
+        S_STARTUP_STEP(create_command_pool,          create_logical_device),
+        S_STARTUP_STEP(create_staging_ring,          create_logical_device),
+        S_STARTUP_STEP(create_uniform_arena,         create_logical_device, select_frames_in_flight),
+        S_STARTUP_STEP(create_texture_streamer),
+        S_STARTUP_STEP(create_render_pass,           create_swapchain),
+        S_STARTUP_STEP(create_depth_resources,       create_swapchain),
+        S_STARTUP_STEP(create_frame_buffers,         create_render_pass, create_depth_resources),
+        S_STARTUP_STEP(begin_setup_uploads,          create_command_pool, create_staging_ring, create_timelines),
+
+        // example specific setup
+        S_STARTUP_STEP(create_asset_archive),
+        S_STARTUP_STEP(create_vertex_layout),
+        S_STARTUP_STEP(create_descriptor_set_layout, create_logical_device),
+        S_STARTUP_STEP(create_descriptor_template,   create_descriptor_set_layout, select_frames_in_flight),
+        S_STARTUP_STEP(create_pipeline_layout,       create_descriptor_set_layout, create_texture_table),
+        S_STARTUP_STEP(create_pipeline,              create_pipeline_layout, create_render_pass, create_vertex_layout, create_asset_archive),
+        S_STARTUP_STEP(create_vertex_buffer,         begin_setup_uploads, create_asset_archive),
+        S_STARTUP_STEP(create_index_buffer,          create_vertex_buffer),
+        S_STARTUP_STEP(create_texture,               create_index_buffer, create_texture_streamer, create_texture_table),
+        S_STARTUP_STEP(submit_setup_uploads,         create_texture)
+    };
+    run_startup_graph(startupSteps, sizeof(startupSteps) / sizeof(startupSteps[0]));
+    print_device_memory_stats();
 
     // main loop
     while (g_running)
     {
+#if S_ASSERT_NO_FRAME_ALLOCATIONS
+        const size_t heapAllocationCount = g_heapAllocationCount;
+#endif
         process_events();
 
-        if(g_windowResized)
+        if(g_windowResized || g_swapChainOutOfDate || g_presentPolicyChanged)
         {
-            // TODO: handle
-            g_windowResized = false;
+            if(!recreate_swapchain())
+                continue;
         }
 
-        begin_frame();
+        if(!begin_frame())
+            continue;
         begin_recording();
+        update_residency();
         update_descriptor_sets();
+        update_constant_buffers();
         begin_render_pass();
-        set_viewport_settings();
-        setup_pipeline_state();
-        draw();
+        record_render_pass_contents();
         end_render_pass();
         end_recording();
         submit_command_buffers_then_present();
+
+        // growable arrays and arenas settle during the warm up frames
+#if S_ASSERT_NO_FRAME_ALLOCATIONS
+        assert((g_frameIndex < S_WARMUP_FRAMES || g_heapAllocationCount == heapAllocationCount) && "heap allocation in the main loop!");
+#endif
     }
 
     cleanup();
@@ -308,6 +899,7 @@ struct QueueFamilyIndices
 {
     int graphicsFamily = -1;
     int presentFamily = -1;
+    int transferFamily = -1; // transfer only (copy engine)
 };
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL
@@ -356,6 +948,8 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
         if (wparam == 'S') g_vertexOffset.y_offset -= 0.01f;
         if (wparam == 'A') g_vertexOffset.x_offset -= 0.01f;
         if (wparam == 'D') g_vertexOffset.x_offset += 0.01f;
+        if (wparam == 'P') cycle_present_policy();
+        note_input_event();
         break;
     }
     case WM_DESTROY:
@@ -377,193 +971,2044 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 
 inline unsigned get_max(unsigned a, unsigned b) { return a > b ? a : b;}
 inline unsigned get_min(unsigned a, unsigned b) { return a < b ? a : b;}
+inline double   get_time_ms() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();}
 
-unsigned
-find_memory_type(unsigned typeFilter, VkMemoryPropertyFlags properties)
+static void*
+arena_alloc(LinearArena& arena, size_t size, size_t alignment = 16u)
 {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(g_physicalDevice, &memProperties);
+    std::unique_lock<std::mutex> lock;
+    if(arena.mutex)
+        lock = std::unique_lock<std::mutex>(*arena.mutex);
 
-    for (unsigned i = 0; i < memProperties.memoryTypeCount; i++) 
+    ArenaBlock* block = arena.block;
+    size_t offset = 0u;
+    if(block)
     {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) 
-        {
-            return i;
-        }
+        const uintptr_t base = (uintptr_t)(block + 1);
+        offset = ((base + block->used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
     }
-    assert(false && "failed to find suitable memory type!");
-    return 0u;
-}
-
-static QueueFamilyIndices 
-find_queue_families(VkPhysicalDevice device)
-{
-
-    QueueFamilyIndices indices;
-
-    unsigned queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    auto queueFamilies = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties)*queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
 
-    for(int i = 0; i < queueFamilyCount; i++)
+    if(block == nullptr || offset + size > block->size)
     {
-        if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-            indices.graphicsFamily = i;
-
-        VkBool32 presentSupport = false;
-        S_VULKAN(vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_surface, &presentSupport));
-
-        if (presentSupport)
-            indices.presentFamily = i;
-
-        if (indices.graphicsFamily > -1 && indices.presentFamily > -1) // complete
-            break;
-
-        i++;
+        const size_t blockSize = size + alignment > arena.blockSize ? size + alignment : arena.blockSize;
+        ArenaBlock* newBlock = (ArenaBlock*)S_ALLOC(sizeof(ArenaBlock) + blockSize);
+        newBlock->previous = block;
+        newBlock->size = blockSize;
+        newBlock->used = 0u;
+        arena.block = block = newBlock;
+
+        const uintptr_t base = (uintptr_t)(block + 1);
+        offset = ((base + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
     }
-    free(queueFamilies);
-    return indices;
+
+    block->used = offset + size;
+    return (char*)(block + 1) + offset;
 }
 
-static VkImageView
-create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+// new copy for growable arrays living in an arena, the old memory goes with the arena
+static void*
+arena_realloc(LinearArena& arena, void* memory, size_t oldSize, size_t newSize)
 {
-    VkImageViewCreateInfo viewInfo{};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = image;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = format;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
-    viewInfo.subresourceRange.aspectMask = aspectFlags;
-
-    VkImageView imageView;
-    S_VULKAN(vkCreateImageView(g_logicalDevice, &viewInfo, nullptr, &imageView));
-    return imageView;
+    void* newMemory = arena_alloc(arena, newSize);
+    if(memory)
+        memcpy(newMemory, memory, oldSize < newSize ? oldSize : newSize);
+    return newMemory;
 }
 
+// O(1) unless the arena overflowed its block, then the blocks are replaced by a
+// single one big enough for everything so the next round doesn't overflow again
 static void
-create_image(unsigned width, unsigned height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+arena_reset(LinearArena& arena)
 {
-    VkImageCreateInfo imageInfo{};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = width;
-    imageInfo.extent.height = height;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = format;
-    imageInfo.tiling = tiling;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = usage;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.flags = 0; // Optional
+    if(arena.block == nullptr)
+        return;
 
-    S_VULKAN(vkCreateImage(g_logicalDevice, &imageInfo, nullptr, &image));
+    if(arena.block->previous)
+    {
+        size_t totalSize = 0u;
+        while(arena.block)
+        {
+            ArenaBlock* previous = arena.block->previous;
+            totalSize += arena.block->size;
+            free(arena.block);
+            arena.block = previous;
+        }
+        if(totalSize > arena.blockSize)
+            arena.blockSize = totalSize;
+        arena_alloc(arena, 0u);
+    }
+    arena.block->used = 0u;
+}
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(g_logicalDevice, image, &memRequirements);
+// releases the arena's memory (arena_reset keeps it)
+static void
+arena_free(LinearArena& arena)
+{
+    while(arena.block)
+    {
+        ArenaBlock* previous = arena.block->previous;
+        free(arena.block);
+        arena.block = previous;
+    }
+}
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+inline ArenaMark arena_mark(LinearArena& arena) { return { arena.block, arena.block ? arena.block->used : 0u };}
 
-    S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &imageMemory));
-    S_VULKAN(vkBindImageMemory(g_logicalDevice, image, imageMemory, 0));
+// releases everything allocated since the mark
+static void
+arena_rewind(LinearArena& arena, ArenaMark mark)
+{
+    while(arena.block != mark.block)
+    {
+        ArenaBlock* previous = arena.block->previous;
+        free(arena.block);
+        arena.block = previous;
+    }
+    if(arena.block)
+        arena.block->used = mark.used;
 }
 
-static char*
-read_file(const char* file, unsigned& size, const char* mode)
+static void
+execute_job(const Job& job)
 {
-    FILE* dataFile = fopen(file, mode);
+    job.function(job.data, job.index);
+    job.counter->value.fetch_sub(1u, std::memory_order_release);
+}
 
-    if (dataFile == nullptr)
+// the calling thread's newest job, otherwise the oldest of another thread
+static bool
+pop_job(Job& jobOut)
+{
+    JobQueue& queue = g_jobQueues[g_jobThreadIndex];
     {
-        assert(false && "File not found.");
-        return nullptr;
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.count > 0u)
+        {
+            queue.count--;
+            jobOut = queue.jobs[(queue.head + queue.count) % S_JOB_QUEUE_SIZE];
+            g_jobQueuedCount--;
+            return true;
+        }
     }
 
-    // obtain file size:
-    fseek(dataFile, 0, SEEK_END);
-    size = ftell(dataFile);
-    fseek(dataFile, 0, SEEK_SET);
-
-    // allocate memory to contain the whole file:
-    char* data = (char*)malloc(sizeof(char)*size);
-
-    // copy the file into the buffer:
-    size_t result = fread(data, sizeof(char), size, dataFile);
-    if (result != size)
+    for(unsigned i = 1; i < g_jobThreadCount; i++)
     {
-        if (feof(dataFile))
-            printf("Error reading test.bin: unexpected end of file\n");
-        else if (ferror(dataFile)) {
-            perror("Error reading test.bin");
+        JobQueue& victim = g_jobQueues[(g_jobThreadIndex + i) % g_jobThreadCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.count > 0u)
+        {
+            jobOut = victim.jobs[victim.head];
+            victim.head = (victim.head + 1u) % S_JOB_QUEUE_SIZE;
+            victim.count--;
+            g_jobQueuedCount--;
+            return true;
         }
-        assert(false && "File not read.");
     }
-
-    fclose(dataFile);
-
-    return data;
+    return false;
 }
 
-static VkCommandBuffer
-begin_command_buffer()
+// queues function(data, 0..count-1) on the calling thread, counter drops back once all ran
+static void
+run_jobs(JobFunction function, void* data, unsigned count, JobCounter& counter)
 {
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = g_commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(g_logicalDevice, &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    counter.value.fetch_add(count);
+    JobQueue& queue = g_jobQueues[g_jobThreadIndex];
+    for(unsigned i = 0; i < count; i++)
+    {
+        const Job job = { function, data, i, &counter };
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.count < S_JOB_QUEUE_SIZE)
+            {
+                queue.jobs[(queue.head + queue.count) % S_JOB_QUEUE_SIZE] = job;
+                queue.count++;
+                g_jobQueuedCount++;
+                queued = true;
+            }
+        }
+        if(!queued)
+            execute_job(job);
+    }
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo); 
-    return commandBuffer; 
+    // sleepers check g_jobQueuedCount holding g_jobMutex, taking it here means none of
+    // them can be between that check and going to sleep
+    if(g_jobSleeperCount > 0u)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_jobMutex);
+        }
+        if(count > 1u)
+            g_jobCondition.notify_all();
+        else
+            g_jobCondition.notify_one();
+    }
 }
 
+// runs queued jobs while waiting, safe on the main thread and from inside jobs
 static void
-submit_command_buffer(VkCommandBuffer commandBuffer)
+wait_for_counter(JobCounter& counter)
 {
-    vkEndCommandBuffer(commandBuffer);
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    Job job;
+    while(counter.value.load(std::memory_order_acquire) > 0u)
+    {
+        if(pop_job(job))
+            execute_job(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+static void
+job_thread_main(unsigned threadIndex)
+{
+    g_jobThreadIndex = threadIndex;
+    Job job;
+    unsigned failedAttempts = 0u;
+    while(true)
+    {
+        if(pop_job(job))
+        {
+            execute_job(job);
+            failedAttempts = 0u;
+            continue;
+        }
+
+        if(++failedAttempts < S_JOB_SPIN_COUNT)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(g_jobMutex);
+        g_jobSleeperCount++;
+        g_jobCondition.wait(lock, []{ return g_jobStop || g_jobQueuedCount > 0u; });
+        g_jobSleeperCount--;
+        if(g_jobStop)
+        {
+            arena_free(g_scratchArena);
+            return;
+        }
+        failedAttempts = 0u;
+    }
+}
+
+// queues the steps depending on the finished one whose other dependencies are done too
+static void
+run_startup_step(void* data, unsigned index)
+{
+    StartupStepState& state = *(StartupStepState*)data;
+    state.thread = g_jobThreadIndex;
+    state.start = get_time_ms() - g_startupBegin;
+    state.step->function();
+    state.end = get_time_ms() - g_startupBegin;
+
+    const unsigned finished = (unsigned)(&state - g_startupSteps);
+    g_startupOrder[g_startupFinishedCount++] = finished;
+    for(unsigned i = 0; i < g_startupStepCount; i++)
+    {
+        StartupStepState& dependent = g_startupSteps[i];
+        for(unsigned j = 0; j < dependent.dependencyCount; j++)
+        {
+            if(dependent.dependencies[j] == finished && dependent.remainingDependencies.fetch_sub(1u) == 1u)
+                run_jobs(run_startup_step, &dependent, 1u, g_startupCounter);
+        }
+    }
+}
+
+#if S_LOG_STARTUP_TIMINGS
+// the critical path is the longest chain of dependent steps, the best the graph can do
+// with enough threads
+static void
+print_startup_timings()
+{
+    double pathLength[S_MAX_STARTUP_STEPS]; // ms, of the longest chain ending with the step
+    unsigned pathPrevious[S_MAX_STARTUP_STEPS];
+    unsigned pathEnd = g_startupOrder[0];
+    double serialTime = 0.0;
+    double wallTime = 0.0;
+
+    // every dependency finished before its dependents
+    for(unsigned i = 0; i < g_startupStepCount; i++)
+    {
+        const unsigned stepIndex = g_startupOrder[i];
+        const StartupStepState& state = g_startupSteps[stepIndex];
+        const double duration = state.end - state.start;
+        pathLength[stepIndex] = duration;
+        pathPrevious[stepIndex] = ~0u;
+        for(unsigned j = 0; j < state.dependencyCount; j++)
+        {
+            if(pathLength[state.dependencies[j]] + duration > pathLength[stepIndex])
+            {
+                pathLength[stepIndex] = pathLength[state.dependencies[j]] + duration;
+                pathPrevious[stepIndex] = state.dependencies[j];
+            }
+        }
+        if(pathLength[stepIndex] > pathLength[pathEnd])
+            pathEnd = stepIndex;
+        serialTime += duration;
+        wallTime = state.end > wallTime ? state.end : wallTime;
+    }
+
+    for(unsigned i = 0; i < g_startupStepCount; i++)
+    {
+        const StartupStepState& state = g_startupSteps[i];
+        printf("startup: %-32s %8.2f ms at %8.2f ms on thread %u\n", state.step->name, state.end - state.start, state.start, state.thread);
+    }
+    printf("startup: %.2f ms on %u threads, %.2f ms serial, %.2f ms critical path:\n", wallTime, g_jobThreadCount, serialTime, pathLength[pathEnd]);
+    for(unsigned i = pathEnd; i != ~0u; i = pathPrevious[i])
+        printf("startup:   %s\n", g_startupSteps[i].step->name);
+}
+#endif
+
+static void
+run_startup_graph(const StartupStep* steps, unsigned count)
+{
+    assert(count <= S_MAX_STARTUP_STEPS);
+    g_startupStepCount = count;
+    g_startupFinishedCount = 0u;
+    for(unsigned i = 0; i < count; i++)
+    {
+        StartupStepState& state = g_startupSteps[i];
+        state.step = &steps[i];
+        state.dependencyCount = 0u;
+        for(unsigned j = 0; j < S_MAX_STARTUP_DEPENDENCIES && steps[i].dependencies[j]; j++)
+        {
+            unsigned dependency = 0u;
+            while(dependency < count && steps[dependency].function != steps[i].dependencies[j])
+                dependency++;
+            assert(dependency < count && dependency != i && "startup dependency isn't another step");
+            state.dependencies[state.dependencyCount++] = dependency;
+        }
+        state.remainingDependencies = state.dependencyCount;
+    }
+
+    // all roots are found before any runs, a finished root may already queue other steps
+    unsigned roots[S_MAX_STARTUP_STEPS];
+    unsigned rootCount = 0u;
+    for(unsigned i = 0; i < count; i++)
+    {
+        if(g_startupSteps[i].dependencyCount == 0u)
+            roots[rootCount++] = i;
+    }
+
+    g_startupBegin = get_time_ms();
+    for(unsigned i = 0; i < rootCount; i++)
+        run_jobs(run_startup_step, &g_startupSteps[roots[i]], 1u, g_startupCounter);
+    wait_for_counter(g_startupCounter);
+    assert(g_startupFinishedCount == count && "startup graph has a cycle");
+
+#if S_LOG_STARTUP_TIMINGS
+    print_startup_timings();
+#endif
+}
+
+#if S_JOB_BENCHMARK
+static void
+benchmark_empty_job(void* data, unsigned index)
+{
+}
+
+static void
+benchmark_latency_job(void* data, unsigned index)
+{
+    *(std::chrono::steady_clock::time_point*)data = std::chrono::steady_clock::now();
+}
+
+// throughput of empty jobs waited on by the (helping) main thread, and how long a single
+// job takes to start on another thread while the main thread only spins
+static void
+run_job_benchmark()
+{
+    typedef std::chrono::steady_clock Clock;
+    const unsigned batchSize = 512u;
+    const unsigned batchCount = 2000u;
+
+    const Clock::time_point start = Clock::now();
+    for(unsigned i = 0; i < batchCount; i++)
+    {
+        JobCounter counter;
+        run_jobs(benchmark_empty_job, nullptr, batchSize, counter);
+        wait_for_counter(counter);
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("job system: %u threads, %.2f million jobs/s\n", g_jobThreadCount, (double)batchSize * batchCount / seconds / 1000000.0);
+
+    if(g_jobThreadCount < 2u)
+        return;
+
+    const unsigned sampleCount = 1000u;
+    double totalLatency = 0.0;
+    double maxLatency = 0.0;
+    for(unsigned i = 0; i < sampleCount; i++)
+    {
+        JobCounter counter;
+        Clock::time_point started;
+        const Clock::time_point queued = Clock::now();
+        run_jobs(benchmark_latency_job, &started, 1u, counter);
+        while(counter.value.load(std::memory_order_acquire) > 0u)
+            std::this_thread::yield();
+        const double latency = std::chrono::duration<double, std::micro>(started - queued).count();
+        totalLatency += latency;
+        maxLatency = latency > maxLatency ? latency : maxLatency;
+    }
+    printf("job system: steal latency %.1f us average, %.1f us max\n", totalLatency / sampleCount, maxLatency);
+}
+#endif
+
+static const char*
+memory_usage_name(MemoryUsage usage)
+{
+    static const char* names[MEMORY_USAGE_COUNT] = { "gpu only", "static", "dynamic", "upload", "readback", "transient" };
+    return names[usage];
+}
+
+// candidates in order of preference, the first memory type allowed by typeFilter that has
+// all of the required flags and none of the avoided ones wins
+static unsigned
+find_memory_type(unsigned typeFilter, MemoryUsage usage)
+{
+    struct Candidate
+    {
+        VkMemoryPropertyFlags required;
+        VkMemoryPropertyFlags avoided;
+        bool                  largeHeap; // excludes the 256MB BAR, it is kept for dynamic data
+    };
+
+    const VkMemoryPropertyFlags deviceLocal = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    const VkMemoryPropertyFlags hostCoherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    static const Candidate candidates[MEMORY_USAGE_COUNT][3] = { // zero required flags end a list
+        { { deviceLocal, hostVisible, false }, { deviceLocal, 0, false } },
+        { { deviceLocal | hostCoherent, 0, true }, { deviceLocal, 0, false }, { hostCoherent, 0, false } },
+        { { deviceLocal | hostVisible, 0, false }, { hostVisible, 0, false } },
+        { { hostCoherent, deviceLocal, false }, { hostCoherent, 0, false } },
+        { { hostVisible | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0, false }, { hostVisible, 0, false } },
+        { { deviceLocal | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, 0, false }, { deviceLocal, hostVisible, false }, { deviceLocal, 0, false } }
+    };
+
+    for(unsigned c = 0; c < 3 && candidates[usage][c].required != 0; c++)
+    {
+        const Candidate& candidate = candidates[usage][c];
+        for(unsigned i = 0; i < g_memoryProperties.memoryTypeCount; i++)
+        {
+            const VkMemoryPropertyFlags flags = g_memoryProperties.memoryTypes[i].propertyFlags;
+            if(!(typeFilter & (1 << i)) || (flags & candidate.required) != candidate.required || (flags & candidate.avoided) != 0)
+                continue;
+            if(candidate.largeHeap && g_memoryProperties.memoryHeaps[g_memoryProperties.memoryTypes[i].heapIndex].size < S_REBAR_MIN_HEAP_SIZE)
+                continue;
+            return i;
+        }
+    }
+    assert(false && "failed to find suitable memory type!");
+    return 0u;
+}
+
+inline VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) { return (value + alignment - 1) & ~(alignment - 1);}
+
+// true if the last byte of one resource and the first byte of the next
+// land on the same bufferImageGranularity "page"
+inline bool
+on_same_page(VkDeviceSize endOfFirst, VkDeviceSize startOfSecond, VkDeviceSize pageSize)
+{
+    return (endOfFirst & ~(pageSize - 1)) == (startOfSecond & ~(pageSize - 1));
+}
+
+static void
+insert_memory_range(DeviceMemoryBlock& block, unsigned index, DeviceMemoryRange range)
+{
+    if(block.rangeCount == block.rangeCapacity)
+    {
+        block.rangeCapacity = block.rangeCapacity == 0 ? 16u : block.rangeCapacity * 2u;
+        block.ranges = (DeviceMemoryRange*)S_REALLOC(block.ranges, sizeof(DeviceMemoryRange)*block.rangeCapacity);
+    }
+    memmove(&block.ranges[index + 1], &block.ranges[index], sizeof(DeviceMemoryRange)*(block.rangeCount - index));
+    block.ranges[index] = range;
+    block.rangeCount++;
+}
+
+static void
+remove_memory_range(DeviceMemoryBlock& block, unsigned index)
+{
+    memmove(&block.ranges[index], &block.ranges[index + 1], sizeof(DeviceMemoryRange)*(block.rangeCount - index - 1));
+    block.rangeCount--;
+}
+
+// first-fit search of a single block, returns false if the request doesn't fit
+static bool
+allocate_from_block(DeviceMemoryBlock& block, VkMemoryRequirements requirements, bool linear, VkDeviceSize& offsetOut)
+{
+    const VkDeviceSize granularity = g_deviceProperties.limits.bufferImageGranularity;
+
+    for(unsigned i = 0; i < block.rangeCount; i++)
+    {
+        const DeviceMemoryRange range = block.ranges[i];
+        if(!range.free || range.size < requirements.size)
+            continue;
+
+        VkDeviceSize offset = align_up(range.offset, requirements.alignment);
+
+        // neighbours of a free range are always in use (free ranges are merged)
+        if(i > 0 && block.ranges[i - 1].linear != linear && granularity > 1)
+        {
+            const DeviceMemoryRange& previous = block.ranges[i - 1];
+            if(on_same_page(previous.offset + previous.size - 1, offset, granularity))
+                offset = align_up(offset, granularity);
+        }
+
+        const VkDeviceSize end = offset + requirements.size;
+        if(end > range.offset + range.size)
+            continue;
+
+        if(i + 1 < block.rangeCount && block.ranges[i + 1].linear != linear && granularity > 1)
+        {
+            if(on_same_page(end - 1, block.ranges[i + 1].offset, granularity))
+                continue;
+        }
+
+        // split: [padding][allocation][remainder]
+        unsigned index = i;
+        block.ranges[index].offset = offset;
+        block.ranges[index].size = requirements.size;
+        block.ranges[index].free = false;
+        block.ranges[index].linear = linear;
+
+        if(offset > range.offset)
+        {
+            insert_memory_range(block, index, {range.offset, offset - range.offset, true, false});
+            index++;
+        }
+
+        if(end < range.offset + range.size)
+            insert_memory_range(block, index + 1, {end, range.offset + range.size - end, true, false});
+
+        block.usedSize += requirements.size;
+        offsetOut = offset;
+        return true;
+    }
+    return false;
+}
+
+// returns the block index, ~0u when the device is out of memory
+static unsigned
+create_memory_block(unsigned memoryType, VkDeviceSize size, bool dedicated)
+{
+    DeviceMemoryHeap& heap = g_deviceMemoryHeaps[memoryType];
+    assert(g_deviceMemoryBlockCount < g_deviceProperties.limits.maxMemoryAllocationCount);
+
+    // reuse a released slot so allocation block indices stay stable
+    unsigned blockIndex = heap.blockCount;
+    for(unsigned i = 0; i < heap.blockCount; i++)
+    {
+        if(heap.blocks[i].memory == VK_NULL_HANDLE)
+        {
+            blockIndex = i;
+            break;
+        }
+    }
+
+    if(blockIndex == heap.blockCount)
+    {
+        if(heap.blockCount == heap.blockCapacity)
+        {
+            heap.blockCapacity = heap.blockCapacity == 0 ? 4u : heap.blockCapacity * 2u;
+            heap.blocks = (DeviceMemoryBlock*)S_REALLOC(heap.blocks, sizeof(DeviceMemoryBlock)*heap.blockCapacity);
+        }
+        heap.blocks[blockIndex] = {};
+        heap.blockCount++;
+    }
+
+    DeviceMemoryBlock& block = heap.blocks[blockIndex];
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    const VkResult result = vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &block.memory);
+    if(result == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+    {
+        // slot stays free, callers fail gracefully (see update_residency)
+        printf("out of device memory: %llu bytes of memory type %u\n", (unsigned long long)size, memoryType);
+        block.memory = VK_NULL_HANDLE;
+        return ~0u;
+    }
+    S_VULKAN(result);
+    g_deviceMemoryBlockCount++;
+
+    block.size = size;
+    block.usedSize = 0u;
+    block.dedicated = dedicated;
+    block.rangeCount = 0u;
+    block.mapping = nullptr;
+    insert_memory_range(block, 0, {0, size, true, false});
+
+    if(g_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        S_VULKAN(vkMapMemory(g_logicalDevice, block.memory, 0, VK_WHOLE_SIZE, 0, (void**)&block.mapping));
+
+    return blockIndex;
+}
+
+static void
+destroy_memory_block(unsigned memoryType, unsigned blockIndex)
+{
+    DeviceMemoryBlock& block = g_deviceMemoryHeaps[memoryType].blocks[blockIndex];
+    if(block.mapping)
+        vkUnmapMemory(g_logicalDevice, block.memory);
+    vkFreeMemory(g_logicalDevice, block.memory, nullptr);
+    g_deviceMemoryBlockCount--;
+    block.memory = VK_NULL_HANDLE;
+    block.mapping = nullptr;
+    block.size = 0u;
+    block.usedSize = 0u;
+    block.rangeCount = 0u;
+}
+
+// allocation.memory is VK_NULL_HANDLE when the device is out of memory
+static DeviceAllocation
+allocate_device_memory(VkMemoryRequirements requirements, MemoryUsage usage, bool linear)
+{
+    std::lock_guard<std::mutex> lock(g_deviceMemoryMutex);
+    const unsigned memoryType = find_memory_type(requirements.memoryTypeBits, usage);
+    DeviceMemoryHeap& heap = g_deviceMemoryHeaps[memoryType];
+
+#if S_LOG_MEMORY_PLACEMENT
+    const VkMemoryPropertyFlags flags = g_memoryProperties.memoryTypes[memoryType].propertyFlags;
+    printf("memory placement: %-9s %10llu bytes -> type %u (heap %u)%s%s%s%s%s\n", memory_usage_name(usage), (unsigned long long)requirements.size,
+        memoryType, g_memoryProperties.memoryTypes[memoryType].heapIndex,
+        flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT ? " DEVICE_LOCAL" : "",
+        flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ? " HOST_VISIBLE" : "",
+        flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ? " HOST_COHERENT" : "",
+        flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT ? " HOST_CACHED" : "",
+        flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT ? " LAZILY_ALLOCATED" : "");
+#endif
+
+    // small heaps (e.g. 256MB BAR) get proportionally smaller blocks
+    const VkDeviceSize heapSize = g_memoryProperties.memoryHeaps[g_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize blockSize = S_DEVICE_MEMORY_BLOCK_SIZE;
+    if(heapSize / 8 < blockSize)
+        blockSize = align_up(heapSize / 8, 1024*1024);
+
+    DeviceAllocation allocation{};
+    allocation.memoryType = memoryType;
+    allocation.size = requirements.size;
+
+    bool found = false;
+
+    // large resources get their own block
+    if(requirements.size > blockSize / 2)
+    {
+        allocation.block = create_memory_block(memoryType, requirements.size, true);
+        if(allocation.block == ~0u)
+            return DeviceAllocation{};
+        found = allocate_from_block(heap.blocks[allocation.block], requirements, linear, allocation.offset);
+    }
+
+    for(unsigned i = 0; i < heap.blockCount && !found; i++)
+    {
+        DeviceMemoryBlock& block = heap.blocks[i];
+        if(block.memory == VK_NULL_HANDLE || block.dedicated || block.size - block.usedSize < requirements.size)
+            continue;
+
+        allocation.block = i;
+        found = allocate_from_block(block, requirements, linear, allocation.offset);
+    }
+
+    if(!found)
+    {
+        allocation.block = create_memory_block(memoryType, blockSize, false);
+        if(allocation.block == ~0u)
+            return DeviceAllocation{};
+        found = allocate_from_block(heap.blocks[allocation.block], requirements, linear, allocation.offset);
+    }
+    assert(found && "failed to sub-allocate device memory!");
+
+    const DeviceMemoryBlock& block = heap.blocks[allocation.block];
+    allocation.memory = block.memory;
+    allocation.mapping = block.mapping ? block.mapping + allocation.offset : nullptr;
+    return allocation;
+}
+
+static void
+free_device_memory(DeviceAllocation& allocation)
+{
+    if(allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_deviceMemoryMutex);
+    DeviceMemoryHeap& heap = g_deviceMemoryHeaps[allocation.memoryType];
+    DeviceMemoryBlock& block = heap.blocks[allocation.block];
+    assert(block.memory == allocation.memory);
+
+    unsigned index = 0;
+    while(index < block.rangeCount && block.ranges[index].offset != allocation.offset)
+        index++;
+    assert(index < block.rangeCount && !block.ranges[index].free);
+
+    block.ranges[index].free = true;
+    block.ranges[index].linear = false;
+    block.usedSize -= block.ranges[index].size;
+
+    // merge with free neighbours
+    if(index + 1 < block.rangeCount && block.ranges[index + 1].free)
+    {
+        block.ranges[index].size += block.ranges[index + 1].size;
+        remove_memory_range(block, index + 1);
+    }
+    if(index > 0 && block.ranges[index - 1].free)
+    {
+        block.ranges[index - 1].size += block.ranges[index].size;
+        remove_memory_range(block, index);
+    }
+
+    // release dedicated blocks right away, keep at most one empty shared block around
+    if(block.usedSize == 0)
+    {
+        bool otherEmptyBlock = false;
+        for(unsigned i = 0; i < heap.blockCount; i++)
+        {
+            if(i != allocation.block && heap.blocks[i].memory != VK_NULL_HANDLE && !heap.blocks[i].dedicated && heap.blocks[i].usedSize == 0)
+                otherEmptyBlock = true;
+        }
+        if(block.dedicated || otherEmptyBlock)
+            destroy_memory_block(allocation.memoryType, allocation.block);
+    }
+
+    allocation = {};
+}
+
+static void
+print_device_memory_stats()
+{
+    printf("Device Memory\n");
+    printf("-------------------------\n");
+
+    VkDeviceSize totalReserved = 0u;
+    VkDeviceSize totalUsed = 0u;
+    unsigned totalAllocations = 0u;
+    for(unsigned i = 0; i < g_memoryProperties.memoryTypeCount; i++)
+    {
+        const DeviceMemoryHeap& heap = g_deviceMemoryHeaps[i];
+        unsigned blockCount = 0u;
+        unsigned allocationCount = 0u;
+        unsigned freeRangeCount = 0u;
+        VkDeviceSize reserved = 0u;
+        VkDeviceSize used = 0u;
+        VkDeviceSize freeSize = 0u;
+        VkDeviceSize largestFreeRange = 0u;
+        for(unsigned j = 0; j < heap.blockCount; j++)
+        {
+            const DeviceMemoryBlock& block = heap.blocks[j];
+            if(block.memory == VK_NULL_HANDLE)
+                continue;
+            blockCount++;
+            reserved += block.size;
+            used += block.usedSize;
+            for(unsigned k = 0; k < block.rangeCount; k++)
+            {
+                if(block.ranges[k].free)
+                {
+                    freeRangeCount++;
+                    freeSize += block.ranges[k].size;
+                    largestFreeRange = block.ranges[k].size > largestFreeRange ? block.ranges[k].size : largestFreeRange;
+                }
+                else
+                    allocationCount++;
+            }
+        }
+
+        if(blockCount == 0)
+            continue;
+
+        // 0% when all free space is one contiguous range
+        const float fragmentation = freeSize > 0 ? 100.0f * (1.0f - (float)largestFreeRange / (float)freeSize) : 0.0f;
+        printf("Memory Type %u: %u blocks, %u allocations, %llu/%llu bytes used, %u free ranges, %.1f%% fragmented\n",
+            i, blockCount, allocationCount, (unsigned long long)used, (unsigned long long)reserved, freeRangeCount, fragmentation);
+
+        totalReserved += reserved;
+        totalUsed += used;
+        totalAllocations += allocationCount;
+    }
+    printf("Total: %u vkAllocateMemory calls, %u allocations, %llu/%llu bytes used\n",
+        g_deviceMemoryBlockCount, totalAllocations, (unsigned long long)totalUsed, (unsigned long long)totalReserved);
+}
+
+// false (and no buffer) when out of device memory
+static bool
+create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage, VkBuffer& buffer, DeviceAllocation& allocation)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &buffer));
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(g_logicalDevice, buffer, &memRequirements);
+
+    allocation = allocate_device_memory(memRequirements, memoryUsage, true);
+    if(allocation.memory == VK_NULL_HANDLE)
+    {
+        vkDestroyBuffer(g_logicalDevice, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
+        return false;
+    }
+    S_VULKAN(vkBindBufferMemory(g_logicalDevice, buffer, allocation.memory, allocation.offset));
+    return true;
+}
+
+// "is gpu work N done?", only asks the driver if the cached value is behind
+static bool
+timeline_reached(Timeline& timeline, uint64_t value)
+{
+    if(value > timeline.completed)
+        S_VULKAN(vkGetSemaphoreCounterValue(g_logicalDevice, timeline.semaphore, &timeline.completed));
+    return value <= timeline.completed;
+}
+
+static void
+timeline_wait(Timeline& timeline, uint64_t value)
+{
+    if(value <= timeline.completed)
+        return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline.semaphore;
+    waitInfo.pValues = &value;
+    S_VULKAN(vkWaitSemaphores(g_logicalDevice, &waitInfo, UINT64_MAX));
+    timeline.completed = value;
+}
+
+// frees ring space of every submission whose value has been reached (or all of them if wait is set)
+static void
+staging_ring_reclaim(bool wait)
+{
+    StagingRing& ring = g_stagingRing;
+    while(ring.retirementCount > 0)
+    {
+        StagingRetirement& retirement = ring.retirements[ring.retirementStart];
+        if(!timeline_reached(*retirement.timeline, retirement.value))
+        {
+            if(!wait)
+                break;
+            timeline_wait(*retirement.timeline, retirement.value);
+        }
+        ring.tail = retirement.end;
+        ring.retirementStart = (ring.retirementStart + 1) % S_STAGING_RING_RETIREMENTS;
+        ring.retirementCount--;
+    }
+
+    // empty ring, start over so large chunks don't have to wrap
+    if(ring.tail == ring.head)
+    {
+        ring.head = 0u;
+        ring.tail = 0u;
+        ring.retiredHead = 0u;
+    }
+}
+
+// everything allocated since the last call is released once timeline reaches value
+static void
+staging_ring_retire(Timeline& timeline, uint64_t value)
+{
+    StagingRing& ring = g_stagingRing;
+    if(ring.head == ring.retiredHead)
+        return;
+
+    if(ring.retirementCount == S_STAGING_RING_RETIREMENTS)
+    {
+        // oldest submission has to finish before we can track another one
+        StagingRetirement& oldest = ring.retirements[ring.retirementStart];
+        timeline_wait(*oldest.timeline, oldest.value);
+        ring.tail = oldest.end;
+        ring.retirementStart = (ring.retirementStart + 1) % S_STAGING_RING_RETIREMENTS;
+        ring.retirementCount--;
+    }
+
+    const unsigned index = (ring.retirementStart + ring.retirementCount) % S_STAGING_RING_RETIREMENTS;
+    ring.retirements[index].end = ring.head;
+    ring.retirements[index].timeline = &timeline;
+    ring.retirements[index].value = value;
+    ring.retirementCount++;
+    ring.retiredHead = ring.head;
+}
+
+// bump allocates size bytes, returns false if the ring is full
+static bool
+staging_ring_allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offsetOut)
+{
+    StagingRing& ring = g_stagingRing;
+    assert(size <= ring.size);
+
+    for(int attempt = 0; attempt < 2; attempt++)
+    {
+        VkDeviceSize offset = align_up(ring.head, alignment);
+
+        // allocations never straddle the end of the buffer
+        if(offset % ring.size + size > ring.size)
+            offset += ring.size - offset % ring.size;
+
+        if(offset + size - ring.tail <= ring.size)
+        {
+            ring.head = offset + size;
+            offsetOut = offset % ring.size;
+            return true;
+        }
+
+        staging_ring_reclaim(false);
+    }
+    return false;
+}
+
+// FNV-1a
+static uint64_t
+hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = seed ^ 14695981039346656037ull;
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// a set of the frame's holding contents (as laid out for updateTemplate), only written if no set
+// already does. Called once the frame's timeline value has been waited on, so none of its sets are in use.
+static VkDescriptorSet
+descriptor_cache_get(FrameContext& frame, VkDescriptorSetLayout layout, VkDescriptorUpdateTemplate updateTemplate, const void* contents, size_t size, bool& written)
+{
+    DescriptorCache& cache = frame.descriptorCache;
+    uint64_t hash = hash_bytes(contents, size, (uint64_t)layout);
+    hash = hash == 0u ? 1u : hash; // 0 marks empty slots
+
+    // linear probing, the home slot is rewritten if none of the probed slots are free
+    const unsigned home = (unsigned)hash & (S_DESCRIPTOR_CACHE_SIZE - 1u);
+    unsigned slot = home;
+    for(unsigned probe = 0; probe < S_DESCRIPTOR_CACHE_PROBES; probe++)
+    {
+        const unsigned candidate = (home + probe) & (S_DESCRIPTOR_CACHE_SIZE - 1u);
+        if(cache.hashes[candidate] == hash)
+        {
+            written = false;
+            return cache.sets[candidate];
+        }
+        if(cache.hashes[candidate] == 0u)
+        {
+            slot = candidate;
+            break;
+        }
+    }
+
+    if(cache.sets[slot] != VK_NULL_HANDLE && cache.layouts[slot] != layout)
+    {
+        S_VULKAN(vkFreeDescriptorSets(g_logicalDevice, frame.descriptorPool, 1u, &cache.sets[slot]));
+        cache.sets[slot] = VK_NULL_HANDLE;
+    }
+    if(cache.sets[slot] == VK_NULL_HANDLE)
+    {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = frame.descriptorPool;
+        allocInfo.descriptorSetCount = 1u;
+        allocInfo.pSetLayouts = &layout;
+        S_VULKAN(vkAllocateDescriptorSets(g_logicalDevice, &allocInfo, &cache.sets[slot]));
+        cache.layouts[slot] = layout;
+    }
+
+    vkUpdateDescriptorSetWithTemplate(g_logicalDevice, cache.sets[slot], updateTemplate, contents);
+    cache.hashes[slot] = hash;
+    written = true;
+    return cache.sets[slot];
+}
+
+// a destroyed handle can be handed out again, so cached contents naming it can't be trusted.
+// The sets are kept, only their hashes are forgotten.
+static void
+descriptor_cache_reset_all()
+{
+    if(g_frameContexts == nullptr)
+        return;
+    for(unsigned i = 0; i < g_framesInFlight; i++)
+        memset(g_frameContexts[i].descriptorCache.hashes, 0, S_DESCRIPTOR_CACHE_SIZE*sizeof(uint64_t));
+}
+
+// the frame's region is free again once its timeline value has been waited on
+static void
+uniform_arena_begin_frame()
+{
+    g_uniformArena.frameBase = g_currentFrame * g_uniformArena.frameSize;
+    g_uniformArena.head = g_uniformArena.frameBase;
+}
+
+// copies a constant block into this frame's region, returns its dynamic offset
+static unsigned
+uniform_arena_push(const void* data, VkDeviceSize size)
+{
+    const VkDeviceSize offset = align_up(g_uniformArena.head, g_uniformArena.alignment);
+    assert(offset + size <= g_uniformArena.frameBase + g_uniformArena.frameSize && "uniform arena full, increase S_UNIFORM_ARENA_SIZE");
+    memcpy(g_uniformArena.allocation.mapping + offset, data, size);
+    g_uniformArena.head = offset + size;
+    return (unsigned)offset;
+}
+
+// single flush of everything written this frame (only needed for non-coherent memory)
+static void
+uniform_arena_flush()
+{
+    if(g_uniformArena.coherent || g_uniformArena.head == g_uniformArena.frameBase)
+        return;
+
+    const VkDeviceSize atomSize = g_deviceProperties.limits.nonCoherentAtomSize;
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = g_uniformArena.allocation.memory;
+    range.offset = g_uniformArena.allocation.offset + g_uniformArena.frameBase;
+    range.size = align_up(g_uniformArena.head - g_uniformArena.frameBase, atomSize);
+    S_VULKAN(vkFlushMappedMemoryRanges(g_logicalDevice, 1, &range));
+}
+
+static QueueFamilyIndices 
+find_queue_families(VkPhysicalDevice device)
+{
+
+    QueueFamilyIndices indices;
+
+    unsigned queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+    const ArenaMark mark = arena_mark(g_scratchArena);
+    auto queueFamilies = (VkQueueFamilyProperties*)arena_alloc(g_scratchArena, sizeof(VkQueueFamilyProperties)*queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
+
+    for(int i = 0; i < queueFamilyCount; i++)
+    {
+        if (indices.graphicsFamily == -1 && queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            indices.graphicsFamily = i;
+
+        VkBool32 presentSupport = false;
+        S_VULKAN(vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_surface, &presentSupport));
+
+        if (indices.presentFamily == -1 && presentSupport)
+            indices.presentFamily = i;
+
+        // uploads are split into chunks of rows, so only take families without a coarser image granularity
+        const VkExtent3D granularity = queueFamilies[i].minImageTransferGranularity;
+        const bool transferOnly = (queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        if (indices.transferFamily == -1 && transferOnly && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+            indices.transferFamily = i;
+    }
+    arena_rewind(g_scratchArena, mark);
+    return indices;
+}
+
+static VkImageView
+create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+{
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    viewInfo.subresourceRange.aspectMask = aspectFlags;
+
+    VkImageView imageView;
+    S_VULKAN(vkCreateImageView(g_logicalDevice, &viewInfo, nullptr, &imageView));
+    return imageView;
+}
+
+// false (and no image) when out of device memory
+static bool
+create_image(unsigned width, unsigned height, unsigned mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, MemoryUsage memoryUsage, VkImage& image, DeviceAllocation& allocation)
+{
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = tiling;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.flags = 0; // Optional
+
+    S_VULKAN(vkCreateImage(g_logicalDevice, &imageInfo, nullptr, &image));
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(g_logicalDevice, image, &memRequirements);
+
+    allocation = allocate_device_memory(memRequirements, memoryUsage, tiling == VK_IMAGE_TILING_LINEAR);
+    if(allocation.memory == VK_NULL_HANDLE)
+    {
+        vkDestroyImage(g_logicalDevice, image, nullptr);
+        image = VK_NULL_HANDLE;
+        return false;
+    }
+    S_VULKAN(vkBindImageMemory(g_logicalDevice, image, allocation.memory, allocation.offset));
+    return true;
+}
+
+static void 
+transition_image_layout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageSubresourceRange subresourceRange, VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+{
+    //VkCommandBuffer commandBuffer = mvBeginSingleTimeCommands();
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = subresourceRange;
+
+    // Source layouts (old)
+    // Source access mask controls actions that have to be finished on the old layout
+    // before it will be transitioned to the new layout
+    switch (oldLayout)
+    {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+        // Image layout is undefined (or does not matter)
+        // Only valid as initial layout
+        // No flags required, listed only for completeness
+        barrier.srcAccessMask = 0;
+        break;
+
+    case VK_IMAGE_LAYOUT_PREINITIALIZED:
+        // Image is preinitialized
+        // Only valid as initial layout for linear images, preserves memory contents
+        // Make sure host writes have been finished
+        barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+        // Image is a color attachment
+        // Make sure any writes to the color buffer have been finished
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+        // Image is a depth/stencil attachment
+        // Make sure any writes to the depth/stencil buffer have been finished
+        barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        // Image is a transfer source
+        // Make sure any reads from the image have been finished
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        // Image is a transfer destination
+        // Make sure any writes to the image have been finished
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        // Image is read by a shader
+        // Make sure any shader reads from the image have been finished
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        break;
+    default:
+        // Other source layouts aren't handled (yet)
+        break;
+    }
+
+    // Target layouts (new)
+    // Destination access mask controls the dependency for the new image layout
+    switch (newLayout)
+    {
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        // Image will be used as a transfer destination
+        // Make sure any writes to the image have been finished
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        // Image will be used as a transfer source
+        // Make sure any reads from the image have been finished
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+        // Image will be used as a color attachment
+        // Make sure any writes to the color buffer have been finished
+        barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+        // Image layout will be used as a depth/stencil attachment
+        // Make sure any writes to depth/stencil buffer have been finished
+        barrier.dstAccessMask = barrier.dstAccessMask | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        break;
+
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        // Image will be read in a shader (sampler, input attachment)
+        // Make sure any writes to the image have been finished
+        if (barrier.srcAccessMask == 0)
+        {
+            barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        break;
+    default:
+        // Other source layouts aren't handled (yet)
+        break;
+    }
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        srcStageMask, dstStageMask,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier
+    );
+
+    //mvEndSingleTimeCommands(commandBuffer);
+}
+
+// level 0 must be in TRANSFER_SRC_OPTIMAL, the remaining levels are overwritten. Each
+// level is blitted from the previous one, all of them end up SHADER_READ_ONLY_OPTIMAL.
+static void
+record_mip_generation(VkCommandBuffer commandBuffer, const MipGeneration& generation)
+{
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 1;
+    subresourceRange.levelCount = generation.mipLevels - 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+    transition_image_layout(commandBuffer, generation.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    int width = (int)generation.width;
+    int height = (int)generation.height;
+    subresourceRange.levelCount = 1;
+    for(unsigned level = 1; level < generation.mipLevels; level++)
+    {
+        VkImageBlit blit{};
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { width, height, 1 };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        blit.dstOffsets[0] = { 0, 0, 0 };
+        blit.dstOffsets[1] = { width, height, 1 };
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+        vkCmdBlitImage(commandBuffer, generation.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, generation.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        // source of the next level
+        subresourceRange.baseMipLevel = level;
+        transition_image_layout(commandBuffer, generation.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = generation.mipLevels;
+    transition_image_layout(commandBuffer, generation.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+// maps file into memory, the pages are shared with the OS page cache (no heap copy)
+static bool
+map_file(const char* file, FileView& view)
+{
+    view = {};
+#ifdef _WIN32
+    view.file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(view.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(view.file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(view.file);
+        return false;
+    }
+
+    view.mapping = CreateFileMappingA(view.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(view.mapping == nullptr)
+    {
+        CloseHandle(view.file);
+        return false;
+    }
+
+    view.data = (const unsigned char*)MapViewOfFile(view.mapping, FILE_MAP_READ, 0, 0, 0);
+    view.size = (size_t)fileSize.QuadPart;
+    if(view.data == nullptr)
+    {
+        CloseHandle(view.mapping);
+        CloseHandle(view.file);
+        return false;
+    }
+#elif defined(__APPLE__)
+#else // linux
+    int fileDescriptor = open(file, O_RDONLY);
+    if(fileDescriptor == -1)
+        return false;
+
+    struct stat fileStat;
+    if(fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fileDescriptor);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor); // mapping keeps the file referenced
+    if(data == MAP_FAILED)
+        return false;
+
+    madvise(data, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+    view.data = (const unsigned char*)data;
+    view.size = (size_t)fileStat.st_size;
+#endif
+    return true;
+}
+
+static void
+unmap_file(FileView& view)
+{
+    if(view.data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(view.data);
+    CloseHandle(view.mapping);
+    CloseHandle(view.file);
+#elif defined(__APPLE__)
+#else // linux
+    munmap((void*)view.data, view.size);
+#endif
+    view = {};
+}
+
+// texel block dimensions and size of the formats textures can be stored in
+static bool
+format_block_info(VkFormat format, unsigned& blockWidth, unsigned& blockHeight, unsigned& blockSize)
+{
+    blockWidth = 4u;
+    blockHeight = 4u;
+    switch(format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        blockWidth = 1u;
+        blockHeight = 1u;
+        blockSize = 4u;
+        return true;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+        blockSize = 8u;
+        return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+        blockSize = 16u;
+        return true;
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+        blockWidth = 6u;
+        blockHeight = 6u;
+        blockSize = 16u;
+        return true;
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+        blockWidth = 8u;
+        blockHeight = 8u;
+        blockSize = 16u;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static VkDeviceSize
+texture_level_size(VkFormat format, unsigned width, unsigned height)
+{
+    unsigned blockWidth, blockHeight, blockSize;
+    if(!format_block_info(format, blockWidth, blockHeight, blockSize))
+        return 0u;
+    return (VkDeviceSize)((width + blockWidth - 1) / blockWidth) * ((height + blockHeight - 1) / blockHeight) * blockSize;
+}
+
+static unsigned
+mip_level_count(unsigned width, unsigned height)
+{
+    unsigned mipLevels = 1u;
+    while(((width | height) >> mipLevels) > 0u && mipLevels < S_MAX_MIP_LEVELS)
+        mipLevels++;
+    return mipLevels;
+}
+
+static bool
+texture_format_supported(VkFormat format)
+{
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(g_physicalDevice, format, &properties);
+    return properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+}
+
+// mip chain can be generated with linear filtered vkCmdBlitImage
+static bool
+texture_format_blittable(VkFormat format)
+{
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(g_physicalDevice, format, &properties);
+    return (properties.optimalTilingFeatures & required) == required;
+}
+
+// format block compressed textures are decoded to when the device can't sample them,
+// VK_FORMAT_UNDEFINED if there is no cpu decoder (BC4-7, ETC2 punch-through alpha, ASTC)
+static VkFormat
+texture_decoded_format(VkFormat format)
+{
+    switch(format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+        return VK_FORMAT_R8G8B8A8_SRGB;
+    default:
+        return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static unsigned char
+clamp_to_byte(int value)
+{
+    return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// BC1 color block (also the color half of BC2/BC3, which never use the 3 color + transparent mode)
+static void
+decode_bc1_block(const unsigned char* block, unsigned char* texels, bool threeColorMode)
+{
+    const unsigned color0 = block[0] | (block[1] << 8);
+    const unsigned color1 = block[2] | (block[3] << 8);
+    const unsigned indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned)block[7] << 24);
+
+    unsigned char palette[4][4];
+    for(unsigned i = 0; i < 2; i++)
+    {
+        const unsigned color = i == 0 ? color0 : color1;
+        const unsigned r = (color >> 11) & 31;
+        const unsigned g = (color >> 5) & 63;
+        const unsigned b = color & 31;
+        palette[i][0] = (unsigned char)((r << 3) | (r >> 2));
+        palette[i][1] = (unsigned char)((g << 2) | (g >> 4));
+        palette[i][2] = (unsigned char)((b << 3) | (b >> 2));
+        palette[i][3] = 255;
+    }
+    const bool fourColors = color0 > color1 || !threeColorMode;
+    for(unsigned c = 0; c < 3; c++)
+    {
+        if(fourColors)
+        {
+            palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c] + 1) / 3);
+            palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+        }
+        else
+        {
+            palette[2][c] = (unsigned char)((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = fourColors ? 255 : 0;
+
+    for(unsigned i = 0; i < 16; i++)
+        memcpy(&texels[i * 4], palette[(indices >> (2 * i)) & 3], 4);
+}
+
+// BC3 alpha block (8 or 6 interpolated values)
+static void
+decode_bc3_alpha_block(const unsigned char* block, unsigned char* texels)
+{
+    unsigned alpha[8];
+    alpha[0] = block[0];
+    alpha[1] = block[1];
+    if(alpha[0] > alpha[1])
+    {
+        for(unsigned i = 1; i < 7; i++)
+            alpha[i + 1] = ((7 - i) * alpha[0] + i * alpha[1] + 3) / 7;
+    }
+    else
+    {
+        for(unsigned i = 1; i < 5; i++)
+            alpha[i + 1] = ((5 - i) * alpha[0] + i * alpha[1] + 2) / 5;
+        alpha[6] = 0;
+        alpha[7] = 255;
+    }
+
+    uint64_t indices = 0u;
+    for(unsigned i = 0; i < 6; i++)
+        indices |= (uint64_t)block[2 + i] << (8 * i);
+    for(unsigned i = 0; i < 16; i++)
+        texels[i * 4 + 3] = (unsigned char)alpha[(indices >> (3 * i)) & 7];
+}
+
+// ETC2 RGB8 block (individual, differential, T, H and planar modes)
+static void
+decode_etc2_rgb_block(const unsigned char* data, unsigned char* texels)
+{
+    static const int modifiers[8][2] = { {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183} };
+    static const int distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+    uint64_t block = 0u;
+    for(unsigned i = 0; i < 8; i++)
+        block = (block << 8) | data[i];
+    auto bits = [block](unsigned high, unsigned low) { return (int)((block >> low) & ((1ull << (high - low + 1)) - 1)); };
+    auto extend4 = [](int value) { return (value << 4) | value; };
+    auto extend5 = [](int value) { return (value << 3) | (value >> 2); };
+
+    // texel index: column major, msb plane in bits 31..16
+    auto texel_index = [block](unsigned x, unsigned y) { const unsigned i = x * 4 + y; return (int)((((block >> (16 + i)) & 1) << 1) | ((block >> i) & 1)); };
+    auto write = [texels](unsigned x, unsigned y, int r, int g, int b) {
+        unsigned char* texel = &texels[(y * 4 + x) * 4];
+        texel[0] = clamp_to_byte(r); texel[1] = clamp_to_byte(g); texel[2] = clamp_to_byte(b); texel[3] = 255;
+    };
+
+    int baseColors[2][3];
+    if(bits(33, 33) == 0) // individual
+    {
+        baseColors[0][0] = extend4(bits(63, 60)); baseColors[1][0] = extend4(bits(59, 56));
+        baseColors[0][1] = extend4(bits(55, 52)); baseColors[1][1] = extend4(bits(51, 48));
+        baseColors[0][2] = extend4(bits(47, 44)); baseColors[1][2] = extend4(bits(43, 40));
+    }
+    else
+    {
+        const int base[3] = { bits(63, 59), bits(55, 51), bits(47, 43) };
+        const int delta[3] = { bits(58, 56), bits(50, 48), bits(42, 40) };
+        int second[3];
+        for(unsigned c = 0; c < 3; c++)
+            second[c] = base[c] + (delta[c] >= 4 ? delta[c] - 8 : delta[c]);
+
+        if(second[0] < 0 || second[0] > 31) // T mode
+        {
+            const int color0[3] = { extend4((bits(60, 59) << 2) | bits(57, 56)), extend4(bits(55, 52)), extend4(bits(51, 48)) };
+            const int color1[3] = { extend4(bits(47, 44)), extend4(bits(43, 40)), extend4(bits(39, 36)) };
+            const int distance = distances[(bits(35, 34) << 1) | bits(32, 32)];
+            for(unsigned x = 0; x < 4; x++)
+            {
+                for(unsigned y = 0; y < 4; y++)
+                {
+                    const int index = texel_index(x, y);
+                    const int* color = index == 0 ? color0 : color1;
+                    const int offset = index == 1 ? distance : (index == 3 ? -distance : 0);
+                    write(x, y, color[0] + offset, color[1] + offset, color[2] + offset);
+                }
+            }
+            return;
+        }
+
+        if(second[1] < 0 || second[1] > 31) // H mode
+        {
+            const int raw0[3] = { bits(62, 59), (bits(58, 56) << 1) | bits(52, 52), (bits(51, 51) << 3) | bits(49, 47) };
+            const int raw1[3] = { bits(46, 43), bits(42, 39), bits(38, 35) };
+            const int order = ((raw0[0] << 8) | (raw0[1] << 4) | raw0[2]) >= ((raw1[0] << 8) | (raw1[1] << 4) | raw1[2]) ? 1 : 0;
+            const int distance = distances[(bits(34, 34) << 2) | (bits(32, 32) << 1) | order];
+            for(unsigned x = 0; x < 4; x++)
+            {
+                for(unsigned y = 0; y < 4; y++)
+                {
+                    const int index = texel_index(x, y);
+                    const int* raw = index < 2 ? raw0 : raw1;
+                    const int offset = (index & 1) ? -distance : distance;
+                    write(x, y, extend4(raw[0]) + offset, extend4(raw[1]) + offset, extend4(raw[2]) + offset);
+                }
+            }
+            return;
+        }
+
+        if(second[2] < 0 || second[2] > 31) // planar
+        {
+            auto extend6 = [](int value) { return (value << 2) | (value >> 4); };
+            auto extend7 = [](int value) { return (value << 1) | (value >> 6); };
+            const int origin[3] = { extend6(bits(62, 57)), extend7((bits(56, 56) << 6) | bits(54, 49)), extend6((bits(48, 48) << 5) | (bits(44, 43) << 3) | bits(41, 39)) };
+            const int horizontal[3] = { extend6((bits(38, 34) << 1) | bits(32, 32)), extend7(bits(31, 25)), extend6(bits(24, 19)) };
+            const int vertical[3] = { extend6(bits(18, 13)), extend7(bits(12, 6)), extend6(bits(5, 0)) };
+            for(unsigned x = 0; x < 4; x++)
+            {
+                for(unsigned y = 0; y < 4; y++)
+                {
+                    int color[3];
+                    for(unsigned c = 0; c < 3; c++)
+                        color[c] = ((int)x * (horizontal[c] - origin[c]) + (int)y * (vertical[c] - origin[c]) + 4 * origin[c] + 2) >> 2;
+                    write(x, y, color[0], color[1], color[2]);
+                }
+            }
+            return;
+        }
+
+        for(unsigned c = 0; c < 3; c++)
+        {
+            baseColors[0][c] = extend5(base[c]);
+            baseColors[1][c] = extend5(second[c]);
+        }
+    }
+
+    const int tables[2] = { bits(39, 37), bits(36, 34) };
+    const bool flip = bits(32, 32);
+    for(unsigned x = 0; x < 4; x++)
+    {
+        for(unsigned y = 0; y < 4; y++)
+        {
+            const unsigned subblock = flip ? (y >= 2) : (x >= 2);
+            const int index = texel_index(x, y);
+            const int magnitude = modifiers[tables[subblock]][index & 1];
+            const int offset = (index & 2) ? -magnitude : magnitude;
+            write(x, y, baseColors[subblock][0] + offset, baseColors[subblock][1] + offset, baseColors[subblock][2] + offset);
+        }
+    }
+}
+
+// EAC alpha block of ETC2 RGBA8
+static void
+decode_eac_alpha_block(const unsigned char* data, unsigned char* texels)
+{
+    static const int modifiers[16][8] = {
+        {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12}, {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+        {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10}, {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+        {-2, -6, -8, -10, 1, 5, 7, 9},  {-2, -5, -8, -10, 1, 4, 7, 9},  {-2, -4, -8, -10, 1, 3, 7, 9},  {-2, -5, -7, -10, 1, 4, 6, 9},
+        {-3, -4, -7, -10, 2, 3, 6, 9},  {-1, -2, -3, -10, 0, 1, 2, 9},  {-4, -6, -8, -9, 3, 5, 7, 8},   {-3, -5, -7, -9, 2, 4, 6, 8}
+    };
+
+    uint64_t block = 0u;
+    for(unsigned i = 0; i < 8; i++)
+        block = (block << 8) | data[i];
+
+    const int base = (int)(block >> 56);
+    const int multiplier = (int)((block >> 52) & 15);
+    const int* table = modifiers[(block >> 48) & 15];
+    for(unsigned x = 0; x < 4; x++)
+    {
+        for(unsigned y = 0; y < 4; y++)
+        {
+            const unsigned i = x * 4 + y; // column major
+            texels[(y * 4 + x) * 4 + 3] = clamp_to_byte(base + table[(block >> (45 - 3 * i)) & 7] * multiplier);
+        }
+    }
+}
+
+// decodes one level of a block compressed format (see texture_decoded_format) to RGBA8
+static void
+decode_compressed_level(VkFormat format, const unsigned char* source, unsigned width, unsigned height, unsigned char* pixels)
+{
+    unsigned blockWidth, blockHeight, blockSize;
+    format_block_info(format, blockWidth, blockHeight, blockSize);
+
+    unsigned char texels[16 * 4];
+    for(unsigned blockY = 0; blockY < height; blockY += 4)
+    {
+        for(unsigned blockX = 0; blockX < width; blockX += 4, source += blockSize)
+        {
+            switch(format)
+            {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                decode_bc1_block(source, texels, true);
+                if(format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+                {
+                    for(unsigned i = 0; i < 16; i++)
+                        texels[i * 4 + 3] = 255;
+                }
+                break;
+            case VK_FORMAT_BC2_UNORM_BLOCK:
+            case VK_FORMAT_BC2_SRGB_BLOCK:
+                decode_bc1_block(source + 8, texels, false);
+                for(unsigned i = 0; i < 16; i++)
+                    texels[i * 4 + 3] = (unsigned char)(((source[i / 2] >> (4 * (i & 1))) & 15) * 17);
+                break;
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+                decode_bc1_block(source + 8, texels, false);
+                decode_bc3_alpha_block(source, texels);
+                break;
+            case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+            case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+                decode_etc2_rgb_block(source, texels);
+                break;
+            case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+            case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+                decode_etc2_rgb_block(source + 8, texels);
+                decode_eac_alpha_block(source, texels);
+                break;
+            default:
+                assert(false && "no cpu decoder for format");
+                break;
+            }
+
+            // blocks at the right/bottom edge can hang over the image
+            for(unsigned y = 0; y < 4 && blockY + y < height; y++)
+            {
+                const unsigned columns = width - blockX < 4 ? width - blockX : 4;
+                memcpy(&pixels[((size_t)(blockY + y) * width + blockX) * 4], &texels[y * 16], columns * 4);
+            }
+        }
+    }
+}
+
+// KTX2 container without supercompression, 2D textures only
+static bool
+ktx2_info(const FileView& view, Ktx2Info& info)
+{
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    if(view.size < 80 || memcmp(view.data, identifier, 12) != 0)
+        return false;
+
+    uint32_t header[9];
+    memcpy(header, view.data + 12, sizeof(header));
+    info.format = (VkFormat)header[0];
+    info.width = header[2];
+    info.height = header[3];
+    info.mipLevels = header[7] == 0 ? 1u : header[7]; // 0 asks for runtime generation, only the base is stored then
+
+    const bool is2D = header[3] > 0 && header[4] == 0 && header[5] <= 1 && header[6] == 1;
+    unsigned blockWidth, blockHeight, blockSize;
+    if(!is2D || header[8] != 0 || info.mipLevels > S_MAX_MIP_LEVELS || !format_block_info(info.format, blockWidth, blockHeight, blockSize))
+        return false;
+
+    if(view.size < 80 + (size_t)info.mipLevels * 24)
+        return false;
+
+    for(unsigned level = 0; level < info.mipLevels; level++)
+    {
+        uint64_t levelIndex[2]; // byte offset, byte length
+        memcpy(levelIndex, view.data + 80 + level * 24, sizeof(levelIndex));
+        const unsigned levelWidth = info.width >> level ? info.width >> level : 1;
+        const unsigned levelHeight = info.height >> level ? info.height >> level : 1;
+        if(levelIndex[0] + levelIndex[1] > view.size || levelIndex[1] < texture_level_size(info.format, levelWidth, levelHeight))
+            return false;
+        info.levels[level] = view.data + levelIndex[0];
+    }
+    return true;
+}
+
+// header and table of contents are validated once, blobs are used in place
+static bool
+open_archive(const char* file, AssetArchive& archive)
+{
+    archive = {};
+    if(!map_file(file, archive.file))
+        return false;
+
+    const ArchiveHeader* header = (const ArchiveHeader*)archive.file.data;
+    bool valid = archive.file.size >= sizeof(ArchiveHeader)
+        && header->magic == S_ARCHIVE_MAGIC && header->version == S_ARCHIVE_VERSION
+        && archive.file.size >= sizeof(ArchiveHeader) + (size_t)header->entryCount * sizeof(ArchiveEntry);
+
+    const ArchiveEntry* entries = (const ArchiveEntry*)(archive.file.data + sizeof(ArchiveHeader));
+    for(unsigned i = 0; valid && i < header->entryCount; i++)
+        valid = entries[i].offset % S_ARCHIVE_ALIGNMENT == 0 && entries[i].offset + entries[i].size <= archive.file.size;
+
+    if(!valid)
+    {
+        printf("%s: not a valid asset archive\n", file);
+        unmap_file(archive.file);
+        return false;
+    }
+
+    archive.entries = entries;
+    archive.entryCount = header->entryCount;
+    return true;
+}
+
+static int
+compare_archive_entry(const void* name, const void* entry)
+{
+    return strncmp((const char*)name, ((const ArchiveEntry*)entry)->name, sizeof(ArchiveEntry::name));
+}
+
+// entries are sorted by name when packed
+static const ArchiveEntry*
+find_archive_entry(const AssetArchive& archive, const char* name)
+{
+    return (const ArchiveEntry*)bsearch(name, archive.entries, archive.entryCount, sizeof(ArchiveEntry), compare_archive_entry);
+}
+
+static const unsigned char*
+archive_entry_data(const AssetArchive& archive, const ArchiveEntry& entry)
+{
+    return archive.file.data + entry.offset;
+}
+
+// levels of texture entries are stored most detailed first, tightly packed rows of blocks
+static VkDeviceSize
+archive_texture_level_offset(const ArchiveEntry& entry, unsigned level)
+{
+    VkDeviceSize offset = 0u;
+    for(unsigned i = 0; i < level; i++)
+    {
+        const unsigned levelWidth = entry.width >> i ? entry.width >> i : 1;
+        const unsigned levelHeight = entry.height >> i ? entry.height >> i : 1;
+        offset = align_up(offset + texture_level_size((VkFormat)entry.format, levelWidth, levelHeight), 16u);
+    }
+    return offset;
+}
+
+static VkCommandBuffer
+begin_command_buffer(VkCommandPool commandPool)
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(g_logicalDevice, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo); 
+    return commandBuffer; 
+}
+
+static void
+push_semaphore_wait(SemaphoreWaits& waits, VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stageMask)
+{
+    if(waits.count == waits.capacity)
+    {
+        waits.capacity = waits.capacity == 0u ? 8u : waits.capacity * 2u;
+        waits.semaphores = (VkSemaphore*)S_REALLOC(waits.semaphores, sizeof(VkSemaphore) * waits.capacity);
+        waits.stageMasks = (VkPipelineStageFlags*)S_REALLOC(waits.stageMasks, sizeof(VkPipelineStageFlags) * waits.capacity);
+        waits.values = (uint64_t*)S_REALLOC(waits.values, sizeof(uint64_t) * waits.capacity);
+    }
+    waits.semaphores[waits.count] = semaphore;
+    waits.stageMasks[waits.count] = stageMask;
+    waits.values[waits.count] = value;
+    waits.count++;
+}
+
+static void
+push_image_acquire(AcquireBarriers& acquires, const VkImageMemoryBarrier& barrier, VkPipelineStageFlags dstStageMask)
+{
+    if(acquires.imageCount == acquires.imageCapacity)
+    {
+        acquires.imageCapacity = acquires.imageCapacity == 0u ? 8u : acquires.imageCapacity * 2u;
+        const size_t oldSize = sizeof(VkImageMemoryBarrier) * acquires.imageCount;
+        const size_t newSize = sizeof(VkImageMemoryBarrier) * acquires.imageCapacity;
+        acquires.images = (VkImageMemoryBarrier*)(acquires.arena ? arena_realloc(*acquires.arena, acquires.images, oldSize, newSize) : S_REALLOC(acquires.images, newSize));
+    }
+    acquires.images[acquires.imageCount++] = barrier;
+    acquires.dstStageMask |= dstStageMask;
+}
+
+static void
+push_buffer_acquire(AcquireBarriers& acquires, const VkBufferMemoryBarrier& barrier, VkPipelineStageFlags dstStageMask)
+{
+    if(acquires.bufferCount == acquires.bufferCapacity)
+    {
+        acquires.bufferCapacity = acquires.bufferCapacity == 0u ? 8u : acquires.bufferCapacity * 2u;
+        const size_t oldSize = sizeof(VkBufferMemoryBarrier) * acquires.bufferCount;
+        const size_t newSize = sizeof(VkBufferMemoryBarrier) * acquires.bufferCapacity;
+        acquires.buffers = (VkBufferMemoryBarrier*)(acquires.arena ? arena_realloc(*acquires.arena, acquires.buffers, oldSize, newSize) : S_REALLOC(acquires.buffers, newSize));
+    }
+    acquires.buffers[acquires.bufferCount++] = barrier;
+    acquires.dstStageMask |= dstStageMask;
+}
+
+static void
+push_mip_generation(AcquireBarriers& acquires, const MipGeneration& generation)
+{
+    if(acquires.mipCount == acquires.mipCapacity)
+    {
+        acquires.mipCapacity = acquires.mipCapacity == 0u ? 8u : acquires.mipCapacity * 2u;
+        const size_t oldSize = sizeof(MipGeneration) * acquires.mipCount;
+        const size_t newSize = sizeof(MipGeneration) * acquires.mipCapacity;
+        acquires.mips = (MipGeneration*)(acquires.arena ? arena_realloc(*acquires.arena, acquires.mips, oldSize, newSize) : S_REALLOC(acquires.mips, newSize));
+    }
+    acquires.mips[acquires.mipCount++] = generation;
+}
+
+// frees command buffers of finished submissions, never blocks
+static void
+retire_submissions()
+{
+    staging_ring_reclaim(false);
+
+    unsigned i = 0;
+    while(i < g_pendingSubmissionCount)
+    {
+        PendingSubmission& submission = g_pendingSubmissions[i];
+        if(!timeline_reached(g_transferTimeline, submission.value))
+        {
+            i++;
+            continue;
+        }
+
+        vkFreeCommandBuffers(g_logicalDevice, g_transferCommandPool, 1, &submission.commandBuffer);
+        g_pendingSubmissions[i] = g_pendingSubmissions[--g_pendingSubmissionCount];
+    }
+}
+
+// records the ownership acquires of every upload submitted since the last frame (and the
+// mip chains that need a graphics queue) and makes the frame wait on those uploads
+static void
+acquire_pending_uploads(VkCommandBuffer commandBuffer, SemaphoreWaits& frameWaits)
+{
+    AcquireBarriers& acquires = g_pendingAcquires;
+    if(acquires.imageCount > 0 || acquires.bufferCount > 0)
+    {
+        // waiting for the last upload with acquires covers all earlier ones, source stages
+        // match the wait stages so the acquire is ordered after the wait
+        push_semaphore_wait(frameWaits, g_transferTimeline.semaphore, g_pendingAcquireValue, acquires.dstStageMask);
+        vkCmdPipelineBarrier(commandBuffer, acquires.dstStageMask, acquires.dstStageMask, 0,
+            0, nullptr, acquires.bufferCount, acquires.buffers, acquires.imageCount, acquires.images);
+        acquires.imageCount = 0u;
+        acquires.bufferCount = 0u;
+        acquires.dstStageMask = 0u;
+    }
+
+    for(unsigned i = 0; i < acquires.mipCount; i++)
+        record_mip_generation(commandBuffer, acquires.mips[i]);
+    acquires.mipCount = 0u;
+}
+
+// the batch's barrier arrays come from arena, it must outlive the last submit_upload_batch
+static UploadBatch
+begin_upload_batch(LinearArena& arena)
+{
+    UploadBatch batch{};
+    batch.acquires.arena = &arena;
+    batch.commandBuffer = begin_command_buffer(g_transferCommandPool);
+    return batch;
+}
+
+// submits what has been recorded so far, doesn't wait. Every submission signals the next
+// g_transferTimeline value, the graphics queue waits on the last one with acquires.
+static void
+submit_upload_batch_commands(UploadBatch& batch, bool last)
+{
+    S_VULKAN(vkEndCommandBuffer(batch.commandBuffer));
+
+    AcquireBarriers& acquires = batch.acquires;
+    const bool needsAcquire = last && (acquires.imageCount > 0 || acquires.bufferCount > 0);
+
+    const uint64_t value = ++g_transferTimeline.value;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(g_logicalDevice);
-    vkFreeCommandBuffers(g_logicalDevice, g_commandPool, 1, &commandBuffer);
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &g_transferTimeline.semaphore;
+    S_VULKAN(vkQueueSubmit(g_transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+    staging_ring_retire(g_transferTimeline, value);
+
+    if(g_pendingSubmissionCount == g_pendingSubmissionCapacity)
+    {
+        g_pendingSubmissionCapacity = g_pendingSubmissionCapacity == 0u ? 8u : g_pendingSubmissionCapacity * 2u;
+        g_pendingSubmissions = (PendingSubmission*)S_REALLOC(g_pendingSubmissions, sizeof(PendingSubmission) * g_pendingSubmissionCapacity);
+    }
+    g_pendingSubmissions[g_pendingSubmissionCount++] = { batch.commandBuffer, value };
+
+    if(needsAcquire)
+    {
+        for(unsigned i = 0; i < acquires.imageCount; i++)
+            push_image_acquire(g_pendingAcquires, acquires.images[i], acquires.dstStageMask);
+        for(unsigned i = 0; i < acquires.bufferCount; i++)
+            push_buffer_acquire(g_pendingAcquires, acquires.buffers[i], acquires.dstStageMask);
+        for(unsigned i = 0; i < acquires.mipCount; i++)
+            push_mip_generation(g_pendingAcquires, acquires.mips[i]);
+        g_pendingAcquireValue = value;
+    }
+
+    if(last)
+        acquires = {}; // arrays go with the batch's arena
+
+    batch.timelineValue = value;
+    batch.commandBuffer = VK_NULL_HANDLE;
+    batch.commandCount = 0u;
 }
 
 static void
-copy_buffer_to_image(VkBuffer srcBuffer, VkImage dstImage, unsigned width, unsigned height, unsigned layers=1u)
+submit_upload_batch(UploadBatch& batch)
 {
-    VkCommandBuffer commandBuffer = begin_command_buffer();
+    submit_upload_batch_commands(batch, true);
+}
+
+static bool
+upload_batch_complete(const UploadBatch& batch)
+{
+    assert(batch.commandBuffer == VK_NULL_HANDLE && "batch not submitted");
+    retire_submissions();
+    return timeline_reached(g_transferTimeline, batch.timelineValue);
+}
+
+static void
+wait_upload_batch(const UploadBatch& batch)
+{
+    assert(batch.commandBuffer == VK_NULL_HANDLE && "batch not submitted");
+    timeline_wait(g_transferTimeline, batch.timelineValue);
+    retire_submissions();
+}
 
+static void
+copy_buffer_to_image(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize srcOffset, VkImage dstImage, unsigned mipLevel, unsigned width, unsigned height, unsigned yOffset=0u, unsigned layers=1u)
+{
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = srcOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
 
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.mipLevel = mipLevel;
     region.imageSubresource.baseArrayLayer = 0;
     region.imageSubresource.layerCount = layers;
 
-    region.imageOffset = { 0, 0, 0 };
+    region.imageOffset = { 0, (int)yOffset, 0 };
     region.imageExtent = {
         width,
         height,
@@ -578,128 +3023,839 @@ copy_buffer_to_image(VkBuffer srcBuffer, VkImage dstImage, unsigned width, unsig
         1,
         &region
     );
+}
+
+// out of staging space, submit what has been recorded so far (if anything) so
+// the ring can be reclaimed and keep recording into a new command buffer
+static void
+flush_upload_batch(UploadBatch& batch)
+{
+    if(batch.commandCount == 0u)
+    {
+        staging_ring_reclaim(true);
+        return;
+    }
+    submit_upload_batch_commands(batch, false);
+    staging_ring_reclaim(true);
+    batch.commandBuffer = begin_command_buffer(g_transferCommandPool);
+}
+
+// copies data into dstBuffer through the staging ring, splitting it into chunks
+// if it doesn't fit
+static void
+upload_batch_buffer(UploadBatch& batch, VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+    const char* source = (const char*)data;
+    while(size > 0)
+    {
+        VkDeviceSize chunkSize = size < g_stagingRing.size ? size : g_stagingRing.size;
+        VkDeviceSize stagingOffset = 0u;
+        if(!staging_ring_allocate(chunkSize, 16u, stagingOffset))
+        {
+            flush_upload_batch(batch);
+            continue;
+        }
+
+        memcpy(g_stagingRing.allocation.mapping + stagingOffset, source, chunkSize);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = stagingOffset;
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = chunkSize;
+        vkCmdCopyBuffer(batch.commandBuffer, g_stagingRing.buffer, dstBuffer, 1, &copyRegion);
+        batch.commandCount++;
+
+        source += chunkSize;
+        dstOffset += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+// copies tightly packed texel blocks into dstImage (in TRANSFER_DST_OPTIMAL layout) through
+// the staging ring, splitting it into chunks of whole block rows if it doesn't fit
+static void
+upload_batch_image(UploadBatch& batch, VkImage dstImage, unsigned mipLevel, unsigned width, unsigned height, VkFormat format, const void* data)
+{
+    unsigned blockWidth, blockHeight, blockSize;
+    if(!format_block_info(format, blockWidth, blockHeight, blockSize))
+    {
+        assert(false && "unsupported texture format");
+        return;
+    }
+
+    const unsigned blockRows = (height + blockHeight - 1) / blockHeight;
+    const VkDeviceSize rowSize = (VkDeviceSize)((width + blockWidth - 1) / blockWidth) * blockSize;
+    assert(rowSize <= g_stagingRing.size);
+
+    const char* source = (const char*)data;
+    unsigned row = 0u;
+    while(row < blockRows)
+    {
+        unsigned rowCount = blockRows - row;
+        if(rowCount * rowSize > g_stagingRing.size)
+            rowCount = (unsigned)(g_stagingRing.size / rowSize);
+
+        VkDeviceSize stagingOffset = 0u;
+        if(!staging_ring_allocate(rowCount * rowSize, 16u, stagingOffset))
+        {
+            flush_upload_batch(batch);
+            continue;
+        }
+
+        // extent in texels, the last block row may hang over the edge of the level
+        const unsigned y = row * blockHeight;
+        const unsigned copyHeight = rowCount * blockHeight < height - y ? rowCount * blockHeight : height - y;
+        memcpy(g_stagingRing.allocation.mapping + stagingOffset, source, rowCount * rowSize);
+        copy_buffer_to_image(batch.commandBuffer, g_stagingRing.buffer, stagingOffset, dstImage, mipLevel, width, copyHeight, y);
+        batch.commandCount++;
+
+        source += rowCount * rowSize;
+        row += rowCount;
+    }
+}
+
+// hands a fully uploaded buffer over to the graphics queue. With a dedicated transfer
+// queue this is a queue family ownership release, the acquire is recorded by the next frame.
+static void
+upload_batch_release_buffer(UploadBatch& batch, VkBuffer buffer, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0u;
+    barrier.size = VK_WHOLE_SIZE;
+
+    if(g_transferQueueFamily == g_graphicsQueueFamily)
+    {
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = g_transferQueueFamily;
+    barrier.dstQueueFamilyIndex = g_graphicsQueueFamily;
+    barrier.dstAccessMask = 0u;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    barrier.srcAccessMask = 0u;
+    barrier.dstAccessMask = dstAccessMask;
+    push_buffer_acquire(batch.acquires, barrier, dstStageMask);
+}
+
+// MEMORY_USAGE_STATIC buffers placed in host coherent memory (ReBAR/UMA) are written in
+// place, host writes are visible to the queue at the next submit. Everything else is staged.
+static void
+upload_batch_static_buffer(UploadBatch& batch, VkBuffer buffer, const DeviceAllocation& allocation, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+    if(allocation.mapping && (g_memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        memcpy(allocation.mapping, data, size);
+        return;
+    }
+
+    upload_batch_buffer(batch, buffer, 0u, data, size);
+    upload_batch_release_buffer(batch, buffer, dstStageMask, dstAccessMask);
+}
+
+// same as upload_batch_release_buffer for an image in TRANSFER_DST_OPTIMAL layout,
+// the layout transition happens as part of the ownership transfer
+static void
+upload_batch_release_image(UploadBatch& batch, VkImage image, VkImageSubresourceRange subresourceRange, VkImageLayout newLayout, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = subresourceRange;
+
+    if(g_transferQueueFamily == g_graphicsQueueFamily)
+    {
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = g_transferQueueFamily;
+    barrier.dstQueueFamilyIndex = g_graphicsQueueFamily;
+    barrier.dstAccessMask = 0u;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0u;
+    barrier.dstAccessMask = dstAccessMask;
+    push_image_acquire(batch.acquires, barrier, dstStageMask);
+}
+
+// fills levels 1+ of an image whose level 0 was just uploaded (still TRANSFER_DST_OPTIMAL)
+// and hands it to the fragment shader. Blits need a graphics queue, so with a dedicated
+// transfer queue only level 0 changes owner and the chain is recorded by the next frame.
+static void
+upload_batch_generate_mips(UploadBatch& batch, VkImage image, unsigned width, unsigned height, unsigned mipLevels)
+{
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = 1;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+
+    const MipGeneration generation = { image, width, height, mipLevels };
+    if(g_transferQueueFamily == g_graphicsQueueFamily)
+    {
+        transition_image_layout(batch.commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        record_mip_generation(batch.commandBuffer, generation);
+        return;
+    }
+
+    upload_batch_release_image(batch, image, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    push_mip_generation(batch.acquires, generation);
+}
+
+// objects without memory of their own that frames in flight can still reference, destroyed
+// once those are done
+static void
+defer_destroy_handle(VkObjectType type, uint64_t handle)
+{
+    if(g_deferredHandleCount == g_deferredHandleCapacity)
+    {
+        g_deferredHandleCapacity = g_deferredHandleCapacity == 0u ? 8u : g_deferredHandleCapacity * 2u;
+        g_deferredHandles = (DeferredHandle*)S_REALLOC(g_deferredHandles, sizeof(DeferredHandle) * g_deferredHandleCapacity);
+    }
+    g_deferredHandles[g_deferredHandleCount++] = { type, handle, g_graphicsTimeline.value + 1u }; // the frame being recorded
+}
+
+static void
+defer_destroy_image_view(VkImageView view)
+{
+    defer_destroy_handle(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)view);
+    descriptor_cache_reset_all();
+}
+
+// images (and their memory) can still be read by frames in flight, released once those are
+// done. Either can be empty, for images sharing an allocation.
+static void
+defer_destroy_image(VkImage image, const DeviceAllocation& allocation)
+{
+    if(g_deferredImageCount == g_deferredImageCapacity)
+    {
+        g_deferredImageCapacity = g_deferredImageCapacity == 0u ? 8u : g_deferredImageCapacity * 2u;
+        g_deferredImages = (DeferredImage*)S_REALLOC(g_deferredImages, sizeof(DeferredImage) * g_deferredImageCapacity);
+    }
+    g_deferredImages[g_deferredImageCount++] = { image, allocation, g_graphicsTimeline.value + 1u }; // the frame being recorded
+    g_heapPendingFrees[g_memoryProperties.memoryTypes[allocation.memoryType].heapIndex] += allocation.size;
+}
 
-    submit_command_buffer(commandBuffer);
+// never blocks, anything the gpu has finished with is destroyed
+static void
+process_deferred_destruction()
+{
+    unsigned i = 0;
+    while(i < g_deferredHandleCount)
+    {
+        const DeferredHandle& deferred = g_deferredHandles[i];
+        if(!timeline_reached(g_graphicsTimeline, deferred.value))
+        {
+            i++;
+            continue;
+        }
+        switch(deferred.type)
+        {
+            case VK_OBJECT_TYPE_IMAGE_VIEW:    vkDestroyImageView(g_logicalDevice, (VkImageView)deferred.handle, nullptr); break;
+            case VK_OBJECT_TYPE_FRAMEBUFFER:   vkDestroyFramebuffer(g_logicalDevice, (VkFramebuffer)deferred.handle, nullptr); break;
+            case VK_OBJECT_TYPE_SWAPCHAIN_KHR: vkDestroySwapchainKHR(g_logicalDevice, (VkSwapchainKHR)deferred.handle, nullptr); break;
+            default: assert(false && "unsupported deferred handle type");
+        }
+        g_deferredHandles[i] = g_deferredHandles[--g_deferredHandleCount];
+    }
+
+    i = 0;
+    while(i < g_deferredImageCount)
+    {
+        DeferredImage& deferred = g_deferredImages[i];
+        if(!timeline_reached(g_graphicsTimeline, deferred.value))
+        {
+            i++;
+            continue;
+        }
+        g_heapPendingFrees[g_memoryProperties.memoryTypes[deferred.allocation.memoryType].heapIndex] -= deferred.allocation.size;
+        vkDestroyImage(g_logicalDevice, deferred.image, nullptr);
+        free_device_memory(deferred.allocation);
+        g_deferredImages[i] = g_deferredImages[--g_deferredImageCount];
+    }
+}
+
+// uncompressed 24/32 bit TGA
+static bool
+tga_info(const char* file, const FileView& view, unsigned& width, unsigned& height)
+{
+    if(view.size < 18)
+        return false;
+
+    const unsigned char* header = view.data;
+    const unsigned imageType = header[2];
+    const unsigned bitsPerPixel = header[16];
+    width = header[12] | (header[13] << 8);
+    height = header[14] | (header[15] << 8);
+
+    if(imageType != 2 || (bitsPerPixel != 24 && bitsPerPixel != 32) || header[1] != 0 || width == 0 || height == 0)
+    {
+        printf("%s: only uncompressed 24/32 bit TGA files are supported\n", file);
+        return false;
+    }
+
+    return view.size >= 18u + header[0] + (size_t)width * height * (bitsPerPixel / 8);
+}
+
+// decodes straight from the mapped pages into tightly packed RGBA8
+static void
+tga_decode(const FileView& view, unsigned char* pixels)
+{
+    const unsigned char* header = view.data;
+    const unsigned srcTexelSize = header[16] / 8;
+    const bool topLeftOrigin = header[17] & 0x20;
+    const unsigned width = header[12] | (header[13] << 8);
+    const unsigned height = header[14] | (header[15] << 8);
+    const unsigned char* source = view.data + 18 + header[0]; // skip image id
+
+    // BGR(A) bottom-up to RGBA top-down
+    for(unsigned y = 0; y < height; y++)
+    {
+        const unsigned char* srcRow = &source[(size_t)(topLeftOrigin ? y : height - 1 - y) * width * srcTexelSize];
+        unsigned char* dstRow = &pixels[(size_t)y * width * 4];
+        for(unsigned x = 0; x < width; x++)
+        {
+            dstRow[x * 4 + 0] = srcRow[x * srcTexelSize + 2];
+            dstRow[x * 4 + 1] = srcRow[x * srcTexelSize + 1];
+            dstRow[x * 4 + 2] = srcRow[x * srcTexelSize + 0];
+            dstRow[x * 4 + 3] = srcTexelSize == 4 ? srcRow[x * srcTexelSize + 3] : 255;
+        }
+    }
+}
+
+// 2x2 box filter, odd edges reuse the last row/column. With SSE2, 4 texels
+// per iteration (rounding matches the scalar path).
+static void
+downsample_rgba8(const unsigned char* src, unsigned srcWidth, unsigned srcHeight, unsigned char* dst)
+{
+    const unsigned dstWidth = srcWidth > 1 ? srcWidth / 2 : 1;
+    const unsigned dstHeight = srcHeight > 1 ? srcHeight / 2 : 1;
+    for(unsigned y = 0; y < dstHeight; y++)
+    {
+        const unsigned y0 = y * 2;
+        const unsigned y1 = y0 + 1 < srcHeight ? y0 + 1 : y0;
+        unsigned x = 0;
+#ifdef S_USE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+        for(; srcWidth > 1 && x + 4 <= dstWidth; x += 4)
+        {
+            // 8 source texels from each row, widened to 16 bit
+            const __m128i* row0 = (const __m128i*)&src[((size_t)y0 * srcWidth + x * 2) * 4];
+            const __m128i* row1 = (const __m128i*)&src[((size_t)y1 * srcWidth + x * 2) * 4];
+            const __m128i a = _mm_loadu_si128(row0);
+            const __m128i b = _mm_loadu_si128(row0 + 1);
+            const __m128i c = _mm_loadu_si128(row1);
+            const __m128i d = _mm_loadu_si128(row1 + 1);
+            const __m128i vertical0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero)); // texels 0,1
+            const __m128i vertical1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero)); // texels 2,3
+            const __m128i vertical2 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero)); // texels 4,5
+            const __m128i vertical3 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero)); // texels 6,7
+
+            // add horizontal neighbours: (0+1, 2+3) and (4+5, 6+7)
+            __m128i sum01 = _mm_add_epi16(_mm_unpacklo_epi64(vertical0, vertical1), _mm_unpackhi_epi64(vertical0, vertical1));
+            __m128i sum23 = _mm_add_epi16(_mm_unpacklo_epi64(vertical2, vertical3), _mm_unpackhi_epi64(vertical2, vertical3));
+            sum01 = _mm_srli_epi16(_mm_add_epi16(sum01, two), 2);
+            sum23 = _mm_srli_epi16(_mm_add_epi16(sum23, two), 2);
+            _mm_storeu_si128((__m128i*)&dst[((size_t)y * dstWidth + x) * 4], _mm_packus_epi16(sum01, sum23));
+        }
+#endif
+        for(; x < dstWidth; x++)
+        {
+            const unsigned x0 = x * 2;
+            const unsigned x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;
+            for(unsigned c = 0; c < 4; c++)
+            {
+                const unsigned sum = src[((size_t)y0 * srcWidth + x0) * 4 + c] + src[((size_t)y0 * srcWidth + x1) * 4 + c]
+                                   + src[((size_t)y1 * srcWidth + x0) * 4 + c] + src[((size_t)y1 * srcWidth + x1) * 4 + c];
+                dst[((size_t)y * dstWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+// picks the first variant (by preference) the device can sample, then the first one that can
+// be decoded on the cpu. Levels point into the mapped file unless they had to be decoded.
+static bool
+load_ktx2_texture(StreamedTexture& texture)
+{
+    static const char* variants[] = { ".bc7.ktx2", ".bc3.ktx2", ".bc1.ktx2", ".astc.ktx2", ".etc2.ktx2", ".ktx2" };
+
+    char path[sizeof(texture.path) + 16];
+    FileView fallbackFile{};
+    Ktx2Info fallback{};
+    for(unsigned i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", texture.path, variants[i]);
+        FileView file;
+        Ktx2Info info;
+        if(!map_file(path, file))
+            continue;
+
+        if(!ktx2_info(file, info))
+        {
+            printf("%s: not a supported KTX2 file\n", path);
+            unmap_file(file);
+            continue;
+        }
+
+        if(texture_format_supported(info.format))
+        {
+            unmap_file(fallbackFile);
+            texture.file = file;
+            texture.format = info.format;
+            texture.width = info.width;
+            texture.height = info.height;
+            texture.mipLevels = info.mipLevels;
+            memcpy(texture.levels, info.levels, sizeof(info.levels));
+            return true;
+        }
+
+        if(fallbackFile.data == nullptr && texture_decoded_format(info.format) != VK_FORMAT_UNDEFINED)
+        {
+            fallbackFile = file;
+            fallback = info;
+        }
+        else
+            unmap_file(file);
+    }
+
+    if(fallbackFile.data == nullptr)
+        return false;
+
+    size_t totalSize = 0u;
+    for(unsigned level = 0; level < fallback.mipLevels; level++)
+    {
+        const unsigned levelWidth = fallback.width >> level ? fallback.width >> level : 1;
+        const unsigned levelHeight = fallback.height >> level ? fallback.height >> level : 1;
+        totalSize += (size_t)levelWidth * levelHeight * 4;
+    }
+
+    texture.pixels = (unsigned char*)S_ALLOC(totalSize);
+    texture.format = texture_decoded_format(fallback.format);
+    size_t offset = 0u;
+    for(unsigned level = 0; level < fallback.mipLevels; level++)
+    {
+        const unsigned levelWidth = fallback.width >> level ? fallback.width >> level : 1;
+        const unsigned levelHeight = fallback.height >> level ? fallback.height >> level : 1;
+        decode_compressed_level(fallback.format, fallback.levels[level], levelWidth, levelHeight, &texture.pixels[offset]);
+        texture.levels[level] = &texture.pixels[offset];
+        offset += (size_t)levelWidth * levelHeight * 4;
+    }
+    unmap_file(fallbackFile);
+
+    texture.width = fallback.width;
+    texture.height = fallback.height;
+    texture.mipLevels = fallback.mipLevels;
+    return true;
+}
+
+// decoded to RGBA8 with the remaining levels box filtered on the cpu
+static bool
+load_tga_texture(StreamedTexture& texture)
+{
+    char path[sizeof(texture.path) + 16];
+    snprintf(path, sizeof(path), "%s.tga", texture.path);
+
+    unsigned width = 0u;
+    unsigned height = 0u;
+    FileView file;
+    if(!map_file(path, file) || !tga_info(path, file, width, height))
+    {
+        unmap_file(file);
+        return false;
+    }
+
+    // full mip chain in one allocation, level 0 first
+    const unsigned mipLevels = mip_level_count(width, height);
+    size_t totalSize = 0u;
+    for(unsigned level = 0; level < mipLevels; level++)
+        totalSize += texture_level_size(VK_FORMAT_R8G8B8A8_UNORM, width >> level ? width >> level : 1, height >> level ? height >> level : 1);
+
+    texture.pixels = (unsigned char*)S_ALLOC(totalSize);
+    tga_decode(file, texture.pixels);
+    unmap_file(file);
+
+    size_t offset = 0u;
+    for(unsigned level = 0; level < mipLevels; level++)
+    {
+        const unsigned levelWidth = width >> level ? width >> level : 1;
+        const unsigned levelHeight = height >> level ? height >> level : 1;
+        texture.levels[level] = &texture.pixels[offset];
+        if(level > 0)
+            downsample_rgba8(texture.levels[level - 1], (width >> (level - 1)) ? width >> (level - 1) : 1, (height >> (level - 1)) ? height >> (level - 1) : 1, &texture.pixels[offset]);
+        offset += (size_t)levelWidth * levelHeight * 4;
+    }
+
+    texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+    texture.width = width;
+    texture.height = height;
+    texture.mipLevels = mipLevels;
+    return true;
+}
+
+static void
+streaming_thread_main()
+{
+    while(true)
+    {
+        StreamedTexture* texture = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(g_streamingMutex);
+            g_streamingCondition.wait(lock, []{ return g_streamingStop || g_streamingQueueCount > 0; });
+            if(g_streamingStop)
+                return;
+            texture = g_streamingQueue[0];
+            g_streamingQueueCount--;
+            memmove(g_streamingQueue, &g_streamingQueue[1], sizeof(StreamedTexture*) * g_streamingQueueCount);
+        }
+
+        if(!load_ktx2_texture(*texture) && !load_tga_texture(*texture))
+        {
+            printf("texture streaming: failed to load %s\n", texture->path);
+            texture->state = STREAM_STATE_FAILED;
+            continue;
+        }
+
+        texture->state = STREAM_STATE_LOADED; // publishes everything above to the main thread
+    }
+}
+
+static void
+request_texture_stream(StreamedTexture& texture, const char* file)
+{
+    assert(texture.image == VK_NULL_HANDLE && "texture already streamed");
+    if(file != texture.path) // evicted textures are requested again with their own path
+        strncpy(texture.path, file, sizeof(texture.path) - 1);
+    texture.state = STREAM_STATE_QUEUED;
+
+    bool registered = false;
+    for(unsigned i = 0; i < g_residentTextureCount && !registered; i++)
+        registered = g_residentTextures[i] == &texture;
+    if(!registered)
+    {
+        if(g_residentTextureCount == g_residentTextureCapacity)
+        {
+            g_residentTextureCapacity = g_residentTextureCapacity == 0u ? 8u : g_residentTextureCapacity * 2u;
+            g_residentTextures = (StreamedTexture**)S_REALLOC(g_residentTextures, sizeof(StreamedTexture*) * g_residentTextureCapacity);
+        }
+        g_residentTextures[g_residentTextureCount++] = &texture;
+    }
+
+    std::lock_guard<std::mutex> lock(g_streamingMutex);
+    assert(g_streamingQueueCount < S_STREAMING_QUEUE_SIZE);
+    g_streamingQueue[g_streamingQueueCount++] = &texture;
+    g_streamingCondition.notify_one();
+}
+
+// writes view into a free slot of g_textureTable and returns its index. Slots frames in flight
+// can still sample are never rewritten, the others can be while the set is bound (update
+// unused while pending). Not thread safe, only create_texture and the main loop add textures.
+static unsigned
+texture_table_add(VkImageView view)
+{
+    TextureTable& table = g_textureTable;
+    unsigned slot = table.textureCount;
+    for(unsigned i = 0; i < table.freeCount; i++)
+    {
+        if(timeline_reached(g_graphicsTimeline, table.freeValues[i]))
+        {
+            slot = table.freeSlots[i];
+            table.freeSlots[i] = table.freeSlots[--table.freeCount];
+            table.freeValues[i] = table.freeValues[table.freeCount];
+            break;
+        }
+    }
+    if(slot == table.textureCount)
+    {
+        assert(table.textureCount < S_TEXTURE_TABLE_SIZE && "texture table full, increase S_TEXTURE_TABLE_SIZE");
+        table.textureCount++;
+    }
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = table.set;
+    descriptorWrite.dstBinding = 0u;
+    descriptorWrite.dstArrayElement = slot;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(g_logicalDevice, 1, &descriptorWrite, 0, nullptr);
+    return slot;
+}
+
+// the slot is left as is (partially bound) and handed out again once the frame being
+// recorded is done with it
+static void
+texture_table_release(unsigned slot)
+{
+    TextureTable& table = g_textureTable;
+    assert(table.freeCount < S_TEXTURE_TABLE_SIZE);
+    table.freeSlots[table.freeCount] = slot;
+    table.freeValues[table.freeCount++] = g_graphicsTimeline.value + 1u; // the frame being recorded
+}
+
+// samplers are few and live as long as the table
+static unsigned
+texture_table_add_sampler(VkSampler sampler)
+{
+    TextureTable& table = g_textureTable;
+    assert(table.samplerCount < S_TEXTURE_TABLE_SAMPLERS && "texture table full, increase S_TEXTURE_TABLE_SAMPLERS");
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = table.set;
+    descriptorWrite.dstBinding = 1u;
+    descriptorWrite.dstArrayElement = table.samplerCount;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(g_logicalDevice, 1, &descriptorWrite, 0, nullptr);
+    return table.samplerCount++;
+}
+
+// creates a view of the levels that are resident, the old one (and its texture table slot)
+// is released once unused
+static void
+update_streamed_texture_view(StreamedTexture& texture)
+{
+    if(texture.view != VK_NULL_HANDLE)
+    {
+        defer_destroy_image_view(texture.view);
+        texture_table_release(texture.textureIndex);
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = texture.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = texture.residentLevel;
+    viewInfo.subresourceRange.levelCount = texture.mipLevels - texture.residentLevel;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    S_VULKAN(vkCreateImageView(g_logicalDevice, &viewInfo, nullptr, &texture.view));
+    texture.textureIndex = texture_table_add(texture.view);
 }
 
-static void 
-transition_image_layout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageSubresourceRange subresourceRange, VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+// per heap budget and usage for residency_fits, refreshed once per frame by update_residency
+static void
+residency_query_budgets()
 {
-    //VkCommandBuffer commandBuffer = mvBeginSingleTimeCommands();
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange = subresourceRange;
+    VkDeviceSize reserved[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize unused[VK_MAX_MEMORY_HEAPS] = {};
+    for(unsigned i = 0; i < g_memoryProperties.memoryTypeCount; i++)
+    {
+        const unsigned heap = g_memoryProperties.memoryTypes[i].heapIndex;
+        for(unsigned j = 0; j < g_deviceMemoryHeaps[i].blockCount; j++)
+        {
+            const DeviceMemoryBlock& block = g_deviceMemoryHeaps[i].blocks[j];
+            reserved[heap] += block.size;
+            unused[heap] += block.size - block.usedSize;
+        }
+    }
 
-    // Source layouts (old)
-    // Source access mask controls actions that have to be finished on the old layout
-    // before it will be transitioned to the new layout
-    switch (oldLayout)
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    if(g_memoryBudgetSupported)
     {
-    case VK_IMAGE_LAYOUT_UNDEFINED:
-        // Image layout is undefined (or does not matter)
-        // Only valid as initial layout
-        // No flags required, listed only for completeness
-        barrier.srcAccessMask = 0;
-        break;
+        VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+        memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memoryProperties.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(g_physicalDevice, &memoryProperties);
+    }
 
-    case VK_IMAGE_LAYOUT_PREINITIALIZED:
-        // Image is preinitialized
-        // Only valid as initial layout for linear images, preserves memory contents
-        // Make sure host writes have been finished
-        barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-        break;
+    for(unsigned i = 0; i < g_memoryProperties.memoryHeapCount; i++)
+    {
+        // without the extension only our own allocations are known
+        g_heapBudgets[i] = g_memoryBudgetSupported ? budgetProperties.heapBudget[i] : g_memoryProperties.memoryHeaps[i].size / 100u * S_RESIDENCY_BUDGET_PERCENT;
+        const VkDeviceSize usage = g_memoryBudgetSupported ? budgetProperties.heapUsage[i] : reserved[i];
 
-    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-        // Image is a color attachment
-        // Make sure any writes to the color buffer have been finished
-        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        break;
+        // free space in our blocks and memory about to be released can be reused without allocating
+        const VkDeviceSize reusable = unused[i] + g_heapPendingFrees[i];
+        g_heapUsages[i] = usage > reusable ? usage - reusable : 0u;
+    }
+}
 
-    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-        // Image is a depth/stencil attachment
-        // Make sure any writes to the depth/stencil buffer have been finished
-        barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        break;
+static bool
+residency_fits(unsigned heap, VkDeviceSize size)
+{
+    return g_heapUsages[heap] + size <= g_heapBudgets[heap] / 100u * S_RESIDENCY_HIGH_WATERMARK;
+}
 
-    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-        // Image is a transfer source
-        // Make sure any reads from the image have been finished
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        break;
+static VkDeviceSize
+texture_chain_size(VkFormat format, unsigned width, unsigned height, unsigned mipLevels)
+{
+    VkDeviceSize size = 0u;
+    for(unsigned level = 0; level < mipLevels; level++)
+        size += texture_level_size(format, width >> level ? width >> level : 1, height >> level ? height >> level : 1);
+    return size;
+}
 
-    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-        // Image is a transfer destination
-        // Make sure any writes to the image have been finished
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        break;
+// called once per frame after begin_recording (so the ownership acquire of finished
+// uploads is already recorded), texture.view covers the resident levels
+static void
+update_streamed_texture(StreamedTexture& texture)
+{
+    if(texture.state != STREAM_STATE_LOADED)
+        return;
 
-    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-        // Image is read by a shader
-        // Make sure any shader reads from the image have been finished
-        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        break;
-    default:
-        // Other source layouts aren't handled (yet)
-        break;
+    if(texture.image == VK_NULL_HANDLE)
+    {
+        // drop the most detailed levels while the chain doesn't fit in the budget
+        const unsigned heap = g_memoryProperties.memoryTypes[find_memory_type(~0u, MEMORY_USAGE_GPU_ONLY)].heapIndex;
+        while(texture.mipLevels > 1u && !residency_fits(heap, texture_chain_size(texture.format, texture.width, texture.height, texture.mipLevels)))
+        {
+            memmove(texture.levels, &texture.levels[1], sizeof(texture.levels[0]) * (texture.mipLevels - 1));
+            texture.width = texture.width > 1 ? texture.width / 2 : 1;
+            texture.height = texture.height > 1 ? texture.height / 2 : 1;
+            texture.mipLevels--;
+        }
+
+        // out of device memory, retried next frame (update_residency frees memory meanwhile)
+        if(!create_image(texture.width, texture.height, texture.mipLevels, texture.format, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY,
+            texture.image, texture.allocation))
+            return;
+        texture.residentLevel = texture.mipLevels;
+        texture.uploadLevel = texture.mipLevels;
     }
 
-    // Target layouts (new)
-    // Destination access mask controls the dependency for the new image layout
-    switch (newLayout)
+    if(texture.uploading)
     {
-    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-        // Image will be used as a transfer destination
-        // Make sure any writes to the image have been finished
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        break;
+        if(!upload_batch_complete(texture.batch))
+            return;
+        texture.uploading = false;
+        texture.residentLevel = texture.uploadLevel;
+        update_streamed_texture_view(texture);
+    }
 
-    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-        // Image will be used as a transfer source
-        // Make sure any reads from the image have been finished
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        break;
+    if(texture.uploadLevel == 0u)
+    {
+        free(texture.pixels);
+        texture.pixels = nullptr;
+        unmap_file(texture.file);
+        texture.state = STREAM_STATE_RESIDENT;
+        return;
+    }
 
-    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-        // Image will be used as a color attachment
-        // Make sure any writes to the color buffer have been finished
-        barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        break;
+    // smallest levels first, as many as fit in this frame's budget (at least one)
+    texture.batch = begin_upload_batch(g_frameContexts[g_currentFrame].arena); // submitted this frame
+    VkDeviceSize uploadedSize = 0u;
+    while(texture.uploadLevel > 0u)
+    {
+        const unsigned level = texture.uploadLevel - 1u;
+        const unsigned levelWidth = texture.width >> level ? texture.width >> level : 1;
+        const unsigned levelHeight = texture.height >> level ? texture.height >> level : 1;
+        const VkDeviceSize levelSize = texture_level_size(texture.format, levelWidth, levelHeight);
+        if(uploadedSize > 0u && uploadedSize + levelSize > S_STREAMING_BUDGET)
+            break;
 
-    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-        // Image layout will be used as a depth/stencil attachment
-        // Make sure any writes to depth/stencil buffer have been finished
-        barrier.dstAccessMask = barrier.dstAccessMask | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        break;
+        VkImageSubresourceRange subresourceRange = {};
+        subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        subresourceRange.baseMipLevel = level;
+        subresourceRange.levelCount = 1;
+        subresourceRange.baseArrayLayer = 0;
+        subresourceRange.layerCount = 1;
 
-    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-        // Image will be read in a shader (sampler, input attachment)
-        // Make sure any writes to the image have been finished
-        if (barrier.srcAccessMask == 0)
-        {
-            barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-        }
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        break;
-    default:
-        // Other source layouts aren't handled (yet)
-        break;
+        transition_image_layout(texture.batch.commandBuffer, texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+        upload_batch_image(texture.batch, texture.image, level, levelWidth, levelHeight, texture.format, texture.levels[level]);
+        upload_batch_release_image(texture.batch, texture.image, subresourceRange, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+        uploadedSize += levelSize;
+        texture.uploadLevel = level;
     }
+    submit_upload_batch(texture.batch);
+    texture.uploading = true;
+    return;
+}
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        srcStageMask, dstStageMask,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
+// releases all of the texture's device memory, the next use streams it in again
+static void
+evict_streamed_texture(StreamedTexture& texture)
+{
+    printf("residency: evicted %s (%llu bytes, unused for %llu frames)\n", texture.path, (unsigned long long)texture.allocation.size,
+        (unsigned long long)(g_frameIndex - texture.lastUsedFrame));
+    if(texture.view != VK_NULL_HANDLE)
+        texture_table_release(texture.textureIndex);
+    defer_destroy_image_view(texture.view);
+    defer_destroy_image(texture.image, texture.allocation);
+    texture.view = VK_NULL_HANDLE;
+    texture.image = VK_NULL_HANDLE;
+    texture.allocation = {};
+    texture.state = STREAM_STATE_EVICTED;
+}
 
-    //mvEndSingleTimeCommands(commandBuffer);
+// copies all but the most detailed level into a new image of half the size, recorded
+// into the frame's command buffer (outside a render pass) ahead of the draws using it
+static void
+demote_streamed_texture(StreamedTexture& texture, VkCommandBuffer commandBuffer)
+{
+    assert(texture.state == STREAM_STATE_RESIDENT && texture.mipLevels > 1u);
+    const unsigned width = texture.width > 1 ? texture.width / 2 : 1;
+    const unsigned height = texture.height > 1 ? texture.height / 2 : 1;
+    const unsigned mipLevels = texture.mipLevels - 1u;
+
+    VkImage image;
+    DeviceAllocation allocation;
+    if(!create_image(width, height, mipLevels, texture.format, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY,
+        image, allocation))
+        return;
+
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 1;
+    subresourceRange.levelCount = mipLevels;
+    subresourceRange.baseArrayLayer = 0;
+    subresourceRange.layerCount = 1;
+    transition_image_layout(commandBuffer, texture.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    subresourceRange.baseMipLevel = 0;
+    transition_image_layout(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkImageCopy regions[S_MAX_MIP_LEVELS] = {};
+    for(unsigned level = 0; level < mipLevels; level++)
+    {
+        regions[level].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level + 1u, 0u, 1u };
+        regions[level].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0u, 1u };
+        regions[level].extent = { width >> level ? width >> level : 1, height >> level ? height >> level : 1, 1u };
+    }
+    vkCmdCopyImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions);
+    transition_image_layout(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    printf("residency: demoted %s from %ux%u to %ux%u\n", texture.path, texture.width, texture.height, width, height);
+    defer_destroy_image(texture.image, texture.allocation);
+    texture.image = image;
+    texture.allocation = allocation;
+    texture.width = width;
+    texture.height = height;
+    texture.mipLevels = mipLevels;
+    texture.residentLevel = 0u;
+    texture.uploadLevel = 0u;
+    update_streamed_texture_view(texture);
 }
 
 //-----------------------------------------------------------------------------
@@ -862,6 +4018,45 @@ create_window()
 #endif
 }
 
+// latency vs throughput, each frame in flight lets the cpu run another frame ahead of the
+// gpu (and the display)
+static void
+select_frames_in_flight()
+{
+    g_framesInFlight = S_FRAMES_IN_FLIGHT;
+    if(const char* setting = getenv("PL_FRAMES_IN_FLIGHT"))
+        g_framesInFlight = (unsigned)atoi(setting);
+    g_framesInFlight = get_max(1u, get_min(S_MAX_FRAMES_IN_FLIGHT, g_framesInFlight));
+    printf("frames in flight: %u\n", g_framesInFlight);
+}
+
+static const char*
+present_policy_name(PresentPolicy policy)
+{
+    static const char* names[PRESENT_POLICY_COUNT] = { "lowlatency", "notearing", "powersaving" };
+    return names[policy];
+}
+
+// PL_PRESENT_POLICY is one of the names above
+static void
+select_present_policy()
+{
+    g_presentPolicy = S_PRESENT_POLICY;
+    if(const char* setting = getenv("PL_PRESENT_POLICY"))
+    {
+        for(unsigned i = 0; i < PRESENT_POLICY_COUNT; i++)
+        {
+            if(strcmp(setting, present_policy_name((PresentPolicy)i)) == 0)
+                g_presentPolicy = (PresentPolicy)i;
+        }
+    }
+
+    g_presentLatency = S_PRESENT_LATENCY;
+    if(const char* setting = getenv("PL_PRESENT_LATENCY"))
+        g_presentLatency = (unsigned)atoi(setting);
+    g_presentLatency = get_min(S_MAX_PRESENT_LATENCY, g_presentLatency);
+}
+
 static  void
 create_vulkan_instance()
 {
@@ -874,7 +4069,8 @@ create_vulkan_instance()
     unsigned layerCount = 0u;
     vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
 
-    auto availableLayers = (VkLayerProperties*)malloc(sizeof(VkLayerProperties)*layerCount);
+    const ArenaMark mark = arena_mark(g_scratchArena);
+    auto availableLayers = (VkLayerProperties*)arena_alloc(g_scratchArena, sizeof(VkLayerProperties)*layerCount);
     vkEnumerateInstanceLayerProperties(&layerCount, availableLayers);
 
     bool validationLayersFound = false;
@@ -888,7 +4084,7 @@ create_vulkan_instance()
         }
     }
     assert(validationLayersFound);
-    free(availableLayers);
+    arena_rewind(g_scratchArena, mark);
 #endif
 
     VkApplicationInfo appInfo{};
@@ -989,7 +4185,8 @@ select_physical_device()
     //-----------------------------------------------------------------------------
     // check if device is suitable
     //-----------------------------------------------------------------------------
-    auto devices = (VkPhysicalDevice*)malloc(sizeof(VkPhysicalDevice)*deviceCount);
+    const ArenaMark mark = arena_mark(g_scratchArena);
+    auto devices = (VkPhysicalDevice*)arena_alloc(g_scratchArena, sizeof(VkPhysicalDevice)*deviceCount);
     S_VULKAN(vkEnumeratePhysicalDevices(g_instance, &deviceCount, devices));
 
     // prefer discrete, then memory size
@@ -1008,7 +4205,7 @@ select_physical_device()
             unsigned extensionCount;
             S_VULKAN(vkEnumerateDeviceExtensionProperties(devices[i], nullptr, &extensionCount, nullptr));
 
-            auto availableExtensions = (VkExtensionProperties*)malloc(sizeof(VkExtensionProperties)*extensionCount);
+            auto availableExtensions = (VkExtensionProperties*)arena_alloc(g_scratchArena, sizeof(VkExtensionProperties)*extensionCount);
             S_VULKAN(vkEnumerateDeviceExtensionProperties(devices[i], nullptr, &extensionCount, availableExtensions));
 
             // TODO: ensure required extensions are found
@@ -1029,7 +4226,20 @@ select_physical_device()
         vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
         vkGetPhysicalDeviceMemoryProperties(devices[i], &memoryProperties);
 
-        if (extensionsSupported && swapChainAdequate)
+        // frame and upload synchronization is built on timeline semaphores, texture binding on
+        // descriptor indexing (see create_texture_table)
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &features12;
+        if(deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+            vkGetPhysicalDeviceFeatures2(devices[i], &features);
+        const bool timelineSupported = features12.timelineSemaphore == VK_TRUE;
+        const bool descriptorIndexingSupported = features12.descriptorBindingPartiallyBound && features12.descriptorBindingSampledImageUpdateAfterBind &&
+            features12.descriptorBindingUpdateUnusedWhilePending && features.features.shaderSampledImageArrayDynamicIndexing;
+
+        if (extensionsSupported && swapChainAdequate && timelineSupported && descriptorIndexingSupported)
         {
             for(int j = 0; j < memoryProperties.memoryHeapCount; j++)
             {
@@ -1051,6 +4261,7 @@ select_physical_device()
     g_physicalDevice = devices[bestDeviceIndex];
     vkGetPhysicalDeviceProperties(devices[bestDeviceIndex], &g_deviceProperties);
     vkGetPhysicalDeviceMemoryProperties(devices[bestDeviceIndex], &g_memoryProperties);
+    arena_rewind(g_scratchArena, mark);
     printf("Physical Device Selection\n");
     printf("-------------------------\n");
     printf("Device ID: %u\n", g_deviceProperties.deviceID);
@@ -1071,32 +4282,92 @@ create_logical_device()
 {
     QueueFamilyIndices indices = find_queue_families(g_physicalDevice);
     g_graphicsQueueFamily = indices.graphicsFamily;
+    g_transferQueueFamily = indices.graphicsFamily;
+#if S_USE_TRANSFER_QUEUE
+    if(indices.transferFamily > -1)
+        g_transferQueueFamily = indices.transferFamily;
+#endif
 
-    VkDeviceQueueCreateInfo queueCreateInfos[2];
-    std::set<unsigned> uniqueQueueFamilies = { (unsigned)indices.graphicsFamily, (unsigned)indices.presentFamily };
+    VkDeviceQueueCreateInfo queueCreateInfos[3];
+    std::set<unsigned> uniqueQueueFamilies = { (unsigned)indices.graphicsFamily, (unsigned)indices.presentFamily, g_transferQueueFamily };
 
     float queuePriority = 1.0f;
-    for(int i = 0; i < uniqueQueueFamilies.size(); i++)
+    unsigned queueCreateInfoCount = 0u;
+    for(unsigned queueFamily : uniqueQueueFamilies)
     {
         VkDeviceQueueCreateInfo queueCreateInfo{};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = i;
+        queueCreateInfo.queueFamilyIndex = queueFamily;
         queueCreateInfo.queueCount = 1;
         queueCreateInfo.pQueuePriorities = &queuePriority;
-        queueCreateInfos[i] = queueCreateInfo;
+        queueCreateInfos[queueCreateInfoCount++] = queueCreateInfo;
+    }
+
+    // optional, residency falls back to heap size heuristics and pacing to the graphics
+    // timeline without them
+    const char* enabledExtensions[4] = { g_extensions[0] };
+    unsigned enabledExtensionCount = 1u;
+    bool presentIdAvailable = false;
+    bool presentWaitAvailable = false;
+    {
+        unsigned extensionCount = 0u;
+        S_VULKAN(vkEnumerateDeviceExtensionProperties(g_physicalDevice, nullptr, &extensionCount, nullptr));
+        const ArenaMark mark = arena_mark(g_scratchArena);
+        auto availableExtensions = (VkExtensionProperties*)arena_alloc(g_scratchArena, sizeof(VkExtensionProperties)*extensionCount);
+        S_VULKAN(vkEnumerateDeviceExtensionProperties(g_physicalDevice, nullptr, &extensionCount, availableExtensions));
+        for(unsigned i = 0; i < extensionCount; i++)
+        {
+            if(strcmp(availableExtensions[i].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+                g_memoryBudgetSupported = true;
+            if(strcmp(availableExtensions[i].extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0)
+                presentIdAvailable = true;
+            if(strcmp(availableExtensions[i].extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0)
+                presentWaitAvailable = true;
+        }
+        arena_rewind(g_scratchArena, mark);
+    }
+    if(g_memoryBudgetSupported)
+        enabledExtensions[enabledExtensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    presentWaitFeatures.pNext = &presentIdFeatures;
+    if(presentIdAvailable && presentWaitAvailable)
+    {
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &presentWaitFeatures;
+        vkGetPhysicalDeviceFeatures2(g_physicalDevice, &features);
+        g_presentWaitSupported = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+    }
+    if(g_presentWaitSupported)
+    {
+        enabledExtensions[enabledExtensionCount++] = VK_KHR_PRESENT_ID_EXTENSION_NAME;
+        enabledExtensions[enabledExtensionCount++] = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
     }
 
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.timelineSemaphore = VK_TRUE;
+    features12.descriptorBindingPartiallyBound = VK_TRUE;
+    features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    features12.pNext = g_presentWaitSupported ? &presentWaitFeatures : nullptr; // both features were reported as supported
     {
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &features12;
 
-        createInfo.queueCreateInfoCount = 1u;
+        createInfo.queueCreateInfoCount = queueCreateInfoCount;
         createInfo.pQueueCreateInfos = queueCreateInfos;
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = 1u;
-        createInfo.ppEnabledExtensionNames = g_extensions;
+        createInfo.enabledExtensionCount = enabledExtensionCount;
+        createInfo.ppEnabledExtensionNames = enabledExtensions;
         createInfo.enabledLayerCount = 0;
 #ifdef MV_ENABLE_VALIDATION_LAYERS
         createInfo.enabledLayerCount = 2u;
@@ -1107,6 +4378,71 @@ create_logical_device()
 
     vkGetDeviceQueue(g_logicalDevice, indices.graphicsFamily, 0, &g_graphicsQueue);
     vkGetDeviceQueue(g_logicalDevice, indices.presentFamily, 0, &g_presentQueue);
+    vkGetDeviceQueue(g_logicalDevice, g_transferQueueFamily, 0, &g_transferQueue);
+
+    if(g_presentWaitSupported)
+        g_vkWaitForPresentKHR = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(g_logicalDevice, "vkWaitForPresentKHR");
+    g_presentWaitSupported = g_vkWaitForPresentKHR != nullptr;
+}
+
+// one timeline per stream of submissions that gets waited on, so the values of each only
+// increase in submission order. Uploads get their own even when they share the graphics
+// queue, that way g_graphicsTimeline counts frames and deferred destruction can name the
+// value of a frame before it is submitted.
+static void
+create_timelines()
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0u;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    g_graphicsTimeline = {};
+    g_transferTimeline = {};
+    S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &g_graphicsTimeline.semaphore));
+    S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &g_transferTimeline.semaphore));
+}
+
+static const char*
+present_mode_name(VkPresentModeKHR mode)
+{
+    switch(mode)
+    {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "IMMEDIATE";
+        case VK_PRESENT_MODE_MAILBOX_KHR:      return "MAILBOX";
+        case VK_PRESENT_MODE_FIFO_KHR:         return "FIFO";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+        default:                               return "other";
+    }
+}
+
+// candidates in order of preference, the first one the surface supports wins. FIFO is
+// always supported, so every policy ends with it.
+static VkPresentModeKHR
+choose_present_mode(PresentPolicy policy, const VkPresentModeKHR* supportedModes, unsigned supportedModeCount)
+{
+    static const VkPresentModeKHR candidates[PRESENT_POLICY_COUNT][4] =
+    {
+        { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR }, // low latency
+        { VK_PRESENT_MODE_MAILBOX_KHR,   VK_PRESENT_MODE_FIFO_KHR },                                                                // no tearing
+        { VK_PRESENT_MODE_FIFO_KHR }                                                                                               // power saving
+    };
+
+    for(unsigned i = 0; i < 4; i++)
+    {
+        for(unsigned j = 0; j < supportedModeCount; j++)
+        {
+            if(supportedModes[j] == candidates[policy][i])
+                return supportedModes[j];
+        }
+        if(candidates[policy][i] == VK_PRESENT_MODE_FIFO_KHR)
+            break;
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
 }
 
 static void 
@@ -1133,13 +4469,14 @@ create_swapchain()
     VkBool32 presentSupport = false;
     S_VULKAN(vkGetPhysicalDeviceSurfaceSupportKHR(g_physicalDevice, 0, g_surface, &presentSupport));
     assert(formatCount > 0);
-    swapChainSupport.formats = (VkSurfaceFormatKHR*)malloc(sizeof(VkSurfaceFormatKHR)*formatCount);
+    const ArenaMark mark = arena_mark(g_scratchArena);
+    swapChainSupport.formats = (VkSurfaceFormatKHR*)arena_alloc(g_scratchArena, sizeof(VkSurfaceFormatKHR)*formatCount);
     S_VULKAN(vkGetPhysicalDeviceSurfaceFormatsKHR(g_physicalDevice, g_surface, &formatCount, swapChainSupport.formats));
 
     unsigned presentModeCount = 0u;
     S_VULKAN(vkGetPhysicalDeviceSurfacePresentModesKHR(g_physicalDevice, g_surface, &presentModeCount, nullptr));
     assert(presentModeCount > 0);
-    swapChainSupport.presentModes = (VkPresentModeKHR*)malloc(sizeof(VkPresentModeKHR)*presentModeCount);
+    swapChainSupport.presentModes = (VkPresentModeKHR*)arena_alloc(g_scratchArena, sizeof(VkPresentModeKHR)*presentModeCount);
     S_VULKAN(vkGetPhysicalDeviceSurfacePresentModesKHR(g_physicalDevice, g_surface, &presentModeCount, swapChainSupport.presentModes));
 
     // choose swap surface Format
@@ -1155,16 +4492,9 @@ create_swapchain()
     }
 
     // chose swap present mode
-    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
-    for(int i = 0 ; i < presentModeCount; i++)
-    {
-        const auto& availablePresentMode = swapChainSupport.presentModes[i];
-        if (availablePresentMode == VK_PRESENT_MODE_FIFO_KHR)
-        {
-            presentMode = availablePresentMode;
-            break;
-        }
-    }
+    const VkPresentModeKHR presentMode = choose_present_mode(g_presentPolicy, swapChainSupport.presentModes, presentModeCount);
+
+    arena_rewind(g_scratchArena, mark);
 
     // chose swap extent
     VkExtent2D extent;
@@ -1183,12 +4513,12 @@ create_swapchain()
         extent = actualExtent;
     }
 
-    g_minImageCount = swapChainSupport.capabilities.minImageCount + 1;
+    // one image more than frames in flight, so every frame in flight can get one
+    g_minImageCount = get_max(swapChainSupport.capabilities.minImageCount + 1, g_framesInFlight + 1);
     if (swapChainSupport.capabilities.maxImageCount > 0 && g_minImageCount > swapChainSupport.capabilities.maxImageCount)
         g_minImageCount = swapChainSupport.capabilities.maxImageCount;
 
     {
-        g_framesInFlight = g_minImageCount-1;
         VkSwapchainCreateInfoKHR createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
         createInfo.surface = g_surface;
@@ -1216,13 +4546,20 @@ create_swapchain()
         createInfo.presentMode = presentMode;
         createInfo.clipped = VK_TRUE;
 
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        // images the old swapchain still presents stay valid until it is destroyed
+        createInfo.oldSwapchain = g_swapChain;
 
-        S_VULKAN(vkCreateSwapchainKHR(g_logicalDevice, &createInfo, nullptr, &g_swapChain));
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+        S_VULKAN(vkCreateSwapchainKHR(g_logicalDevice, &createInfo, nullptr, &swapChain));
+        if(g_swapChain != VK_NULL_HANDLE)
+            defer_destroy_handle(VK_OBJECT_TYPE_SWAPCHAIN_KHR, (uint64_t)g_swapChain); // frames in flight still render to its images
+        g_swapChain = swapChain;
     }
+    g_presentMode = presentMode;
+    printf("present mode: %s (%s)\n", present_mode_name(presentMode), present_policy_name(g_presentPolicy));
 
     vkGetSwapchainImagesKHR(g_logicalDevice, g_swapChain, &g_minImageCount, nullptr);
-    g_swapChainImages = (VkImage*)malloc(sizeof(VkImage)*g_minImageCount);
+    g_swapChainImages = (VkImage*)arena_alloc(g_swapChainArena, sizeof(VkImage)*g_minImageCount);
 
     vkGetSwapchainImagesKHR(g_logicalDevice, g_swapChain, &g_minImageCount, g_swapChainImages);
 
@@ -1230,9 +4567,13 @@ create_swapchain()
     g_swapChainExtent = extent;
 
     // creating image views
-    g_swapChainImageViews = (VkImageView*)malloc(sizeof(VkImageView)*g_minImageCount);
+    g_swapChainImageViews = (VkImageView*)arena_alloc(g_swapChainArena, sizeof(VkImageView)*g_minImageCount);
     for (unsigned i = 0; i < g_minImageCount; i++)
         g_swapChainImageViews[i] = create_image_view(g_swapChainImages[i], g_swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    g_imageTimelineValues = (uint64_t*)arena_alloc(g_swapChainArena, sizeof(uint64_t)*g_minImageCount);
+    for (unsigned i = 0; i < g_minImageCount; i++)
+        g_imageTimelineValues[i] = 0u;
 }
 
 static void
@@ -1246,47 +4587,205 @@ create_command_pool()
     commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     S_VULKAN(vkCreateCommandPool(g_logicalDevice, &commandPoolInfo, nullptr, &g_commandPool));
+
+    g_transferCommandPool = g_commandPool;
+    if(g_transferQueueFamily != g_graphicsQueueFamily)
+    {
+        commandPoolInfo.queueFamilyIndex = g_transferQueueFamily;
+        commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        S_VULKAN(vkCreateCommandPool(g_logicalDevice, &commandPoolInfo, nullptr, &g_transferCommandPool));
+    }
 }
 
 static void
-create_main_command_buffers()
+create_staging_ring()
 {
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = g_commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (unsigned)(g_minImageCount);
+    g_stagingRing = {};
+    g_stagingRing.size = S_STAGING_RING_SIZE;
+    create_buffer(g_stagingRing.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD, g_stagingRing.buffer, g_stagingRing.allocation);
+}
+
+static void
+create_uniform_arena()
+{
+    // regions have to start on offsets usable both as dynamic offsets and as flush ranges
+    VkDeviceSize alignment = g_deviceProperties.limits.minUniformBufferOffsetAlignment;
+    if(g_deviceProperties.limits.nonCoherentAtomSize > alignment)
+        alignment = g_deviceProperties.limits.nonCoherentAtomSize;
+
+    g_uniformArena = {};
+    g_uniformArena.alignment = g_deviceProperties.limits.minUniformBufferOffsetAlignment;
+    g_uniformArena.frameSize = align_up(S_UNIFORM_ARENA_SIZE, alignment);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = g_uniformArena.frameSize * g_framesInFlight;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &g_uniformArena.buffer));
 
-    g_commandBuffers = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer)*g_minImageCount);
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(g_logicalDevice, g_uniformArena.buffer, &memRequirements);
+    if(alignment > memRequirements.alignment)
+        memRequirements.alignment = alignment;
+
+    // coherent isn't required, uniform_arena_flush covers the rest
+    g_uniformArena.allocation = allocate_device_memory(memRequirements, MEMORY_USAGE_DYNAMIC, true);
+    S_VULKAN(vkBindBufferMemory(g_logicalDevice, g_uniformArena.buffer, g_uniformArena.allocation.memory, g_uniformArena.allocation.offset));
+    g_uniformArena.coherent = g_memoryProperties.memoryTypes[g_uniformArena.allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
 
-    S_VULKAN(vkAllocateCommandBuffers(g_logicalDevice, &allocInfo, g_commandBuffers));
+static void
+create_texture_streamer()
+{
+    g_streamingStop = false;
+    g_streamingThread = std::thread(streaming_thread_main);
 }
 
+// everything a frame records into or waits on, so nothing has to be indexed by the image
+// the swapchain hands out. A command pool per recording job and frame means recording
+// never has to lock a pool and a frame's buffers are reset all at once after its timeline value.
 static void
-create_descriptor_pool()
+create_frame_contexts()
 {
+    g_frameContexts = (FrameContext*)arena_alloc(g_setupArena, sizeof(FrameContext)*g_framesInFlight);
+
     VkDescriptorPoolSize poolSizes[] =
     {
-        { VK_DESCRIPTOR_TYPE_SAMPLER,                1000 },
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000 },
-        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,          1000 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          1000 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,   1000 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,   1000 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1000 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         1000 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1000 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1000 },
-        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,       1000 }
+        { VK_DESCRIPTOR_TYPE_SAMPLER,                S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,          S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,   S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,   S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, S_DESCRIPTORS_PER_FRAME },
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,       S_DESCRIPTORS_PER_FRAME }
     };
     VkDescriptorPoolCreateInfo descPoolInfo = {};
     descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-    descPoolInfo.maxSets = 1000 * 11;
+    descPoolInfo.maxSets = S_DESCRIPTORS_PER_FRAME * 11;
     descPoolInfo.poolSizeCount = 11u;
     descPoolInfo.pPoolSizes = poolSizes;
 
-    S_VULKAN(vkCreateDescriptorPool(g_logicalDevice, &descPoolInfo, nullptr, &g_descriptorPool));
+    VkCommandPoolCreateInfo commandPoolInfo{};
+    commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolInfo.queueFamilyIndex = g_graphicsQueueFamily;
+    commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for(unsigned i = 0; i < g_framesInFlight; i++)
+    {
+        FrameContext& frame = g_frameContexts[i];
+        frame = {};
+        frame.arena = { nullptr, S_FRAME_ARENA_SIZE };
+
+        S_VULKAN(vkCreateCommandPool(g_logicalDevice, &commandPoolInfo, nullptr, &frame.commandPool));
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1u;
+        S_VULKAN(vkAllocateCommandBuffers(g_logicalDevice, &allocInfo, &frame.commandBuffer));
+
+        S_VULKAN(vkCreateDescriptorPool(g_logicalDevice, &descPoolInfo, nullptr, &frame.descriptorPool));
+        frame.descriptorCache.sets = (VkDescriptorSet*)arena_alloc(g_setupArena, S_DESCRIPTOR_CACHE_SIZE*sizeof(VkDescriptorSet));
+        frame.descriptorCache.layouts = (VkDescriptorSetLayout*)arena_alloc(g_setupArena, S_DESCRIPTOR_CACHE_SIZE*sizeof(VkDescriptorSetLayout));
+        frame.descriptorCache.hashes = (uint64_t*)arena_alloc(g_setupArena, S_DESCRIPTOR_CACHE_SIZE*sizeof(uint64_t));
+        memset(frame.descriptorCache.sets, 0, S_DESCRIPTOR_CACHE_SIZE*sizeof(VkDescriptorSet));
+        memset(frame.descriptorCache.hashes, 0, S_DESCRIPTOR_CACHE_SIZE*sizeof(uint64_t));
+        S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &frame.imageAvailable));
+        S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &frame.renderFinished));
+
+        frame.recordingContexts = (RecordingContext*)arena_alloc(g_setupArena, sizeof(RecordingContext)*g_jobThreadCount);
+        for(unsigned j = 0; j < g_jobThreadCount; j++)
+        {
+            RecordingContext& context = frame.recordingContexts[j];
+            S_VULKAN(vkCreateCommandPool(g_logicalDevice, &commandPoolInfo, nullptr, &context.commandPool));
+
+            allocInfo.commandPool = context.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            S_VULKAN(vkAllocateCommandBuffers(g_logicalDevice, &allocInfo, &context.commandBuffer));
+        }
+    }
+}
+
+// every texture the example samples lives in one set, bound once per command buffer and
+// indexed by the draws (see DrawConstants). Slots are written while the set is bound, so the
+// bindings are update after bind, and only the slots handed out have to be valid.
+static void
+create_texture_table()
+{
+    TextureTable& table = g_textureTable;
+    table = {};
+    table.freeSlots = (unsigned*)arena_alloc(g_setupArena, S_TEXTURE_TABLE_SIZE*sizeof(unsigned));
+    table.freeValues = (uint64_t*)arena_alloc(g_setupArena, S_TEXTURE_TABLE_SIZE*sizeof(uint64_t));
+
+    VkDescriptorSetLayoutBinding bindings[2];
+    bindings[0].binding = 0u;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[0].descriptorCount = S_TEXTURE_TABLE_SIZE;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].pImmutableSamplers = nullptr;
+
+    bindings[1].binding = 1u;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[1].descriptorCount = S_TEXTURE_TABLE_SAMPLERS;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].pImmutableSamplers = nullptr;
+
+    const VkDescriptorBindingFlags bindingFlags[2] =
+    {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = 2u;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 2u;
+    layoutInfo.pBindings = bindings;
+    S_VULKAN(vkCreateDescriptorSetLayout(g_logicalDevice, &layoutInfo, nullptr, &table.layout));
+
+    VkDescriptorPoolSize poolSizes[] =
+    {
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, S_TEXTURE_TABLE_SIZE },
+        { VK_DESCRIPTOR_TYPE_SAMPLER,       S_TEXTURE_TABLE_SAMPLERS }
+    };
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1u;
+    poolInfo.poolSizeCount = 2u;
+    poolInfo.pPoolSizes = poolSizes;
+    S_VULKAN(vkCreateDescriptorPool(g_logicalDevice, &poolInfo, nullptr, &table.pool));
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = table.pool;
+    allocInfo.descriptorSetCount = 1u;
+    allocInfo.pSetLayouts = &table.layout;
+    S_VULKAN(vkAllocateDescriptorSets(g_logicalDevice, &allocInfo, &table.set));
+}
+
+static void
+create_job_system()
+{
+    const unsigned coreCount = std::thread::hardware_concurrency();
+    g_jobThreadCount = get_max(1u, get_min(S_MAX_JOB_THREADS, coreCount));
+    g_jobStop = false;
+    for(unsigned i = 1; i < g_jobThreadCount; i++)
+        g_jobThreads[i] = std::thread(job_thread_main, i);
 }
 
 static void 
@@ -1343,19 +4842,124 @@ create_render_pass()
 static void
 create_depth_resources()
 {
-    VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+    // cleared on load and never stored (see create_render_pass)
+    g_depthAttachment = add_transient_attachment(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        VK_IMAGE_ASPECT_DEPTH_BIT, VK_SAMPLE_COUNT_1_BIT, 0u, 0u);
+    create_transient_attachments();
 
-    create_image(g_swapChainExtent.width, g_swapChainExtent.height, depthFormat,
-        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        g_depthImage, g_depthImageMemory);
+    g_depthImage = g_transientAttachments[g_depthAttachment].image;
+    g_depthImageView = g_transientAttachments[g_depthAttachment].view;
+}
+
+// registered before create_transient_attachments, returns the index into g_transientAttachments
+static unsigned
+add_transient_attachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkSampleCountFlagBits samples, unsigned firstPass, unsigned lastPass)
+{
+    assert(g_transientAttachmentCount < S_MAX_TRANSIENT_ATTACHMENTS && firstPass <= lastPass);
+    TransientAttachment& attachment = g_transientAttachments[g_transientAttachmentCount];
+    attachment = {};
+    attachment.format = format;
+    attachment.usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    attachment.aspect = aspect;
+    attachment.samples = samples;
+    attachment.firstPass = firstPass;
+    attachment.lastPass = lastPass;
+    return g_transientAttachmentCount++;
+}
+
+// swapchain sized images backed by a single allocation. Lazily allocated memory (tilers)
+// is only committed if a render pass actually needs to spill the attachment. Elsewhere,
+// attachments are placed largest first at the lowest offset that doesn't overlap an
+// attachment alive during the same passes, so e.g. a depth buffer and an MSAA target of
+// different passes share memory. The render pass marks them MAY_ALIAS and loads them
+// with CLEAR/DONT_CARE from UNDEFINED, so no contents have to survive aliasing.
+static void
+create_transient_attachments()
+{
+    VkMemoryRequirements requirements[S_MAX_TRANSIENT_ATTACHMENTS];
+    unsigned order[S_MAX_TRANSIENT_ATTACHMENTS];
+    VkMemoryRequirements poolRequirements = {0u, 1u, ~0u};
+    VkDeviceSize unaliasedSize = 0u;
+    for(unsigned i = 0; i < g_transientAttachmentCount; i++)
+    {
+        TransientAttachment& attachment = g_transientAttachments[i];
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = g_swapChainExtent.width;
+        imageInfo.extent.height = g_swapChainExtent.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = attachment.format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = attachment.usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples = attachment.samples;
+        S_VULKAN(vkCreateImage(g_logicalDevice, &imageInfo, nullptr, &attachment.image));
+
+        vkGetImageMemoryRequirements(g_logicalDevice, attachment.image, &requirements[i]);
+        poolRequirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+        poolRequirements.alignment = requirements[i].alignment > poolRequirements.alignment ? requirements[i].alignment : poolRequirements.alignment;
+        unaliasedSize += requirements[i].size;
+
+        // insertion sort, largest first
+        unsigned j = i;
+        for(; j > 0 && requirements[order[j - 1]].size < requirements[i].size; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    assert(poolRequirements.memoryTypeBits != 0u && "transient attachments can't share a memory type!");
+
+    for(unsigned i = 0; i < g_transientAttachmentCount; i++)
+    {
+        TransientAttachment& attachment = g_transientAttachments[order[i]];
+        const VkMemoryRequirements& attachmentRequirements = requirements[order[i]];
+
+        // bump past every placed attachment alive at the same time that overlaps the
+        // candidate range, until a pass finds no conflict
+        VkDeviceSize offset = 0u;
+        for(bool moved = true; moved;)
+        {
+            moved = false;
+            for(unsigned j = 0; j < i; j++)
+            {
+                const TransientAttachment& placed = g_transientAttachments[order[j]];
+                const VkDeviceSize placedEnd = placed.offset + requirements[order[j]].size;
+                if(placed.lastPass < attachment.firstPass || attachment.lastPass < placed.firstPass)
+                    continue;
+                if(placed.offset >= offset + attachmentRequirements.size || placedEnd <= offset)
+                    continue;
+                offset = align_up(placedEnd, attachmentRequirements.alignment);
+                moved = true;
+            }
+        }
+        attachment.offset = offset;
+        if(offset + attachmentRequirements.size > poolRequirements.size)
+            poolRequirements.size = offset + attachmentRequirements.size;
+    }
+
+    g_transientAllocation = allocate_device_memory(poolRequirements, MEMORY_USAGE_TRANSIENT, false);
+    assert(g_transientAllocation.memory != VK_NULL_HANDLE && "out of device memory for attachments!");
+
+    for(unsigned i = 0; i < g_transientAttachmentCount; i++)
+    {
+        TransientAttachment& attachment = g_transientAttachments[i];
+        S_VULKAN(vkBindImageMemory(g_logicalDevice, attachment.image, g_transientAllocation.memory, g_transientAllocation.offset + attachment.offset));
+        attachment.view = create_image_view(attachment.image, attachment.format, attachment.aspect);
+    }
 
-    g_depthImageView = create_image_view(g_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    const bool lazy = g_memoryProperties.memoryTypes[g_transientAllocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    printf("transient attachments: %u images in %llu bytes (%llu without aliasing)%s\n", g_transientAttachmentCount,
+        (unsigned long long)poolRequirements.size, (unsigned long long)unaliasedSize, lazy ? ", lazily allocated" : "");
 }
 
 static void
 create_frame_buffers()
 {
-    g_swapChainFramebuffers = (VkFramebuffer*)malloc(sizeof(VkFramebuffer)*g_minImageCount);
+    g_swapChainFramebuffers = (VkFramebuffer*)arena_alloc(g_swapChainArena, sizeof(VkFramebuffer)*g_minImageCount);
     for (unsigned i = 0; i < g_minImageCount; i++)
     {
         VkImageView imageViews[] = { g_swapChainImageViews[i], g_depthImageView };
@@ -1371,34 +4975,159 @@ create_frame_buffers()
     }
 }
 
-static void
-create_syncronization_primitives()
+// after a resize, a present mode change or an out of date swapchain. Only what depends on
+// the swapchain is rebuilt (the render pass doesn't, the format is the same) and nothing
+// waits: the old objects are still used by the frames in flight, so they go through
+// deferred destruction. Returns false while the window has no area, there's nothing to
+// render to until it has one again.
+static bool
+recreate_swapchain()
 {
-    g_imagesInFlight = (VkFence*)malloc(sizeof(VkFence)*g_minImageCount);
-    g_inFlightFences = (VkFence*)malloc(sizeof(VkFence)*g_minImageCount);
-    g_imageAvailableSemaphores = (VkSemaphore*)malloc(sizeof(VkSemaphore)*g_minImageCount);
-    g_renderFinishedSemaphores = (VkSemaphore*)malloc(sizeof(VkSemaphore)*g_minImageCount);
+    VkSurfaceCapabilitiesKHR capabilities;
+    S_VULKAN(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(g_physicalDevice, g_surface, &capabilities));
+    if(capabilities.currentExtent.width == 0u || capabilities.currentExtent.height == 0u)
+        return false;
 
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for(unsigned i = 0; i < g_minImageCount; i++)
+    {
+        defer_destroy_handle(VK_OBJECT_TYPE_FRAMEBUFFER, (uint64_t)g_swapChainFramebuffers[i]);
+        defer_destroy_image_view(g_swapChainImageViews[i]);
+    }
+    arena_reset(g_swapChainArena); // handles were copied above
 
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    const VkExtent2D oldExtent = g_swapChainExtent;
+    create_swapchain(); // retires the old swapchain
+    g_swapChainFirstPresentId = g_graphicsTimeline.value + 1u;
 
-    for (unsigned i = 0; i < g_minImageCount; i++)
+    if(g_swapChainExtent.width != oldExtent.width || g_swapChainExtent.height != oldExtent.height)
     {
-        g_imagesInFlight[i] = VK_NULL_HANDLE;
-        S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &g_imageAvailableSemaphores[i]));
-        S_VULKAN(vkCreateSemaphore(g_logicalDevice, &semaphoreInfo, nullptr, &g_renderFinishedSemaphores[i]));
-        S_VULKAN(vkCreateFence(g_logicalDevice, &fenceInfo, nullptr, &g_inFlightFences[i]));
+        // same attachments at the new size, in a new allocation
+        for(unsigned i = 0; i < g_transientAttachmentCount; i++)
+        {
+            defer_destroy_image_view(g_transientAttachments[i].view);
+            defer_destroy_image(g_transientAttachments[i].image, {});
+        }
+        defer_destroy_image(VK_NULL_HANDLE, g_transientAllocation);
+        create_transient_attachments();
+        g_depthImage = g_transientAttachments[g_depthAttachment].image;
+        g_depthImageView = g_transientAttachments[g_depthAttachment].view;
+
+        // viewport and scissor are baked into the render pass contents
+        for(unsigned i = 0; i < g_framesInFlight; i++)
+            invalidate_render_pass_contents(i);
     }
+    create_frame_buffers();
+
+    g_windowResized = false;
+    g_swapChainOutOfDate = false;
+    g_presentPolicyChanged = false;
+    return true;
+}
+
+// one batch for every upload done during setup, recorded into by the steps after this
+static void
+begin_setup_uploads()
+{
+    g_setupUploads = begin_upload_batch(g_setupArena);
+}
+
+static void
+submit_setup_uploads()
+{
+    submit_upload_batch(g_setupUploads);
 }
 
 //-----------------------------------------------------------------------------
 // [SECTION] example specific setup function implementations
 //-----------------------------------------------------------------------------
 
+// builds S_ARCHIVE_FILE from the loose shaders and the data above
+static bool
+pack_asset_archive(const char* file)
+{
+    ArchiveEntry entries[5] = {};
+    const void* sources[5] = {};
+    FileView vertexShaderCode;
+    FileView pixelShaderCode;
+    if(!map_file("simple.vert.spv", vertexShaderCode) || !map_file("simple.frag.spv", pixelShaderCode))
+    {
+        unmap_file(vertexShaderCode);
+        return false;
+    }
+
+    strcpy(entries[0].name, "quad.indices");
+    entries[0].type = ARCHIVE_ENTRY_INDEX_DATA;
+    entries[0].size = sizeof(g_indices);
+    sources[0] = g_indices;
+
+    strcpy(entries[1].name, "quad.texture");
+    entries[1].type = ARCHIVE_ENTRY_TEXTURE;
+    entries[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+    entries[1].width = 2u;
+    entries[1].height = 2u;
+    entries[1].mipLevels = 1u; // chain is generated when loaded (see create_texture)
+    entries[1].size = sizeof(g_image);
+    sources[1] = g_image;
+
+    strcpy(entries[2].name, "quad.vertices");
+    entries[2].type = ARCHIVE_ENTRY_VERTEX_DATA;
+    entries[2].size = sizeof(g_vertexData);
+    sources[2] = g_vertexData;
+
+    strcpy(entries[3].name, "simple.frag.spv");
+    entries[3].type = ARCHIVE_ENTRY_SHADER;
+    entries[3].size = pixelShaderCode.size;
+    sources[3] = pixelShaderCode.data;
+
+    strcpy(entries[4].name, "simple.vert.spv");
+    entries[4].type = ARCHIVE_ENTRY_SHADER;
+    entries[4].size = vertexShaderCode.size;
+    sources[4] = vertexShaderCode.data;
+
+    ArchiveHeader header{};
+    header.magic = S_ARCHIVE_MAGIC;
+    header.version = S_ARCHIVE_VERSION;
+    header.entryCount = 5u;
+
+    VkDeviceSize offset = align_up(sizeof(ArchiveHeader) + sizeof(entries), S_ARCHIVE_ALIGNMENT);
+    for(unsigned i = 0; i < header.entryCount; i++)
+    {
+        entries[i].offset = offset;
+        offset = align_up(offset + entries[i].size, S_ARCHIVE_ALIGNMENT);
+    }
+
+    FILE* archiveFile = fopen(file, "wb");
+    bool written = archiveFile != nullptr;
+    if(written)
+    {
+        static const unsigned char padding[S_ARCHIVE_ALIGNMENT] = {};
+        written = fwrite(&header, sizeof(header), 1, archiveFile) == 1 && fwrite(entries, sizeof(entries), 1, archiveFile) == 1;
+        VkDeviceSize position = sizeof(ArchiveHeader) + sizeof(entries);
+        for(unsigned i = 0; written && i < header.entryCount; i++)
+        {
+            written = fwrite(padding, 1, entries[i].offset - position, archiveFile) == entries[i].offset - position
+                && fwrite(sources[i], 1, entries[i].size, archiveFile) == entries[i].size;
+            position = entries[i].offset + entries[i].size;
+        }
+        fclose(archiveFile);
+    }
+
+    unmap_file(vertexShaderCode);
+    unmap_file(pixelShaderCode);
+    return written;
+}
+
+static void
+create_asset_archive()
+{
+    if(open_archive(S_ARCHIVE_FILE, g_assetArchive))
+        return;
+
+    printf("packing %s\n", S_ARCHIVE_FILE);
+    if(!pack_asset_archive(S_ARCHIVE_FILE) || !open_archive(S_ARCHIVE_FILE, g_assetArchive))
+        assert(false && "asset archive not available");
+}
+
 static void
 create_vertex_layout()
 {
@@ -1420,13 +5149,14 @@ create_vertex_layout()
 static void
 create_descriptor_set_layout()
 {
-    VkDescriptorSetLayout descriptorSetLayouts[1] = {g_descriptorSetLayout};
+    // set 1, textures are in g_textureTable (set 0). Dynamic buffers aren't allowed in update
+    // after bind sets, so the constants get one of their own.
     VkDescriptorSetLayoutBinding bindings[1];
 
     bindings[0].binding = 0u;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     bindings[0].descriptorCount = 1;
-    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     bindings[0].pImmutableSamplers = nullptr;
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
@@ -1437,21 +5167,30 @@ create_descriptor_set_layout()
     S_VULKAN(vkCreateDescriptorSetLayout(g_logicalDevice, &layoutInfo, nullptr, &g_descriptorSetLayout));
 }
 
+// every write goes through the template, a set's bindings are read straight out of a
+// FrameDescriptors instead of being described by VkWriteDescriptorSets each time
 static void
-create_descriptor_set()
+create_descriptor_template()
 {
-    // allocate descriptor sets
-    g_descriptorSets = (VkDescriptorSet*)malloc(g_minImageCount*sizeof(VkDescriptorSet));
-    auto layouts = (VkDescriptorSetLayout*)malloc(g_minImageCount*sizeof(VkDescriptorSetLayout));
-    for(int i = 0; i < g_minImageCount; i++)
-        layouts[i] = g_descriptorSetLayout;
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = g_descriptorPool;
-    allocInfo.descriptorSetCount = g_minImageCount;
-    allocInfo.pSetLayouts = layouts;
-
-    S_VULKAN(vkAllocateDescriptorSets(g_logicalDevice, &allocInfo, g_descriptorSets));
+    VkDescriptorUpdateTemplateEntry entries[1];
+    entries[0].dstBinding = 0u;
+    entries[0].dstArrayElement = 0u;
+    entries[0].descriptorCount = 1u;
+    entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    entries[0].offset = offsetof(FrameDescriptors, constants);
+    entries[0].stride = sizeof(VkDescriptorBufferInfo);
+
+    VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+    templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+    templateInfo.descriptorUpdateEntryCount = 1u;
+    templateInfo.pDescriptorUpdateEntries = entries;
+    templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+    templateInfo.descriptorSetLayout = g_descriptorSetLayout;
+    S_VULKAN(vkCreateDescriptorUpdateTemplate(g_logicalDevice, &templateInfo, nullptr, &g_descriptorUpdateTemplate));
+
+    // sets come from the frame's descriptor cache, see update_descriptor_sets
+    g_descriptorSets = (VkDescriptorSet*)arena_alloc(g_setupArena, g_framesInFlight*sizeof(VkDescriptorSet));
+    memset(g_descriptorSets, 0, g_framesInFlight*sizeof(VkDescriptorSet));
 }
 
 static void
@@ -1462,10 +5201,19 @@ create_pipeline_layout()
     multisampling.sampleShadingEnable = VK_FALSE;
     multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+    const VkDescriptorSetLayout setLayouts[2] = { g_textureTable.layout, g_descriptorSetLayout };
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0u;
+    pushConstantRange.size = sizeof(DrawConstants);
+
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &g_descriptorSetLayout;
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     S_VULKAN(vkCreatePipelineLayout(g_logicalDevice, &pipelineLayoutInfo, nullptr, &g_pipelineLayout));
 }
@@ -1473,25 +5221,25 @@ create_pipeline_layout()
 static void
 create_pipeline()
 {
-    unsigned vertexFileSize = 0u;
-    unsigned pixelFileSize = 0u;
-    auto vertexShaderCode = read_file("simple.vert.spv", vertexFileSize, "rb");
-    auto pixelShaderCode = read_file("simple.frag.spv", pixelFileSize, "rb");
+    // archive blobs are aligned, so they can be handed to vulkan as is
+    const ArchiveEntry* vertexShaderEntry = find_archive_entry(g_assetArchive, "simple.vert.spv");
+    const ArchiveEntry* pixelShaderEntry = find_archive_entry(g_assetArchive, "simple.frag.spv");
+    assert(vertexShaderEntry && pixelShaderEntry);
 
     {
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = vertexFileSize;
-        createInfo.pCode = (const uint32_t*)(vertexShaderCode);
-        assert(vkCreateShaderModule(g_logicalDevice, &createInfo, nullptr, &g_vertexShaderModule) == VK_SUCCESS);
+        createInfo.codeSize = vertexShaderEntry->size;
+        createInfo.pCode = (const uint32_t*)archive_entry_data(g_assetArchive, *vertexShaderEntry);
+        S_VULKAN(vkCreateShaderModule(g_logicalDevice, &createInfo, nullptr, &g_vertexShaderModule));
     }
 
     {
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = pixelFileSize;
-        createInfo.pCode = (const uint32_t*)(pixelShaderCode);
-        assert(vkCreateShaderModule(g_logicalDevice, &createInfo, nullptr, &g_pixelShaderModule) == VK_SUCCESS);
+        createInfo.codeSize = pixelShaderEntry->size;
+        createInfo.pCode = (const uint32_t*)archive_entry_data(g_assetArchive, *pixelShaderEntry);
+        S_VULKAN(vkCreateShaderModule(g_logicalDevice, &createInfo, nullptr, &g_pixelShaderModule));
     }
 
     //---------------------------------------------------------------------
@@ -1654,237 +5402,103 @@ create_pipeline()
 static void
 create_vertex_buffer()
 {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferDeviceMemory;
-
-    { // create staging buffer
-
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(float)*16;
-        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &stagingBuffer));
-
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(g_logicalDevice, stagingBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &stagingBufferDeviceMemory));
-        S_VULKAN(vkBindBufferMemory(g_logicalDevice, stagingBuffer, stagingBufferDeviceMemory, 0));
-
-        void* mapping;
-        S_VULKAN(vkMapMemory(g_logicalDevice, stagingBufferDeviceMemory, 0, bufferInfo.size, 0, &mapping));
-        memcpy(mapping, g_vertexData, bufferInfo.size);
-        vkUnmapMemory(g_logicalDevice, stagingBufferDeviceMemory);
-    }
-
-    { // create final buffer
-
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(float)*16;
-        bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &g_vertexBuffer));
-
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(g_logicalDevice, g_vertexBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &g_vertexDeviceMemory));
-        S_VULKAN(vkBindBufferMemory(g_logicalDevice, g_vertexBuffer, g_vertexDeviceMemory, 0));
-    }
+    const ArchiveEntry* entry = find_archive_entry(g_assetArchive, "quad.vertices");
+    assert(entry && entry->type == ARCHIVE_ENTRY_VERTEX_DATA);
 
-    // copy buffer
-    VkCommandBuffer commandBuffer = begin_command_buffer();
-
-    VkBufferCopy copyRegion{};
-    copyRegion.size = sizeof(float)*16;
-    vkCmdCopyBuffer(commandBuffer, stagingBuffer, g_vertexBuffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(g_logicalDevice);
-
-    vkFreeCommandBuffers(g_logicalDevice, g_commandPool, 1, &commandBuffer);
+    create_buffer(entry->size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MEMORY_USAGE_STATIC, g_vertexBuffer, g_vertexAllocation);
+    upload_batch_static_buffer(g_setupUploads, g_vertexBuffer, g_vertexAllocation, archive_entry_data(g_assetArchive, *entry), entry->size,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 }
 
 static void
 create_index_buffer()
 {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferDeviceMemory;
-
-    { // create staging buffer
-
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(unsigned)*6;
-        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &stagingBuffer));
-
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(g_logicalDevice, stagingBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &stagingBufferDeviceMemory));
-        S_VULKAN(vkBindBufferMemory(g_logicalDevice, stagingBuffer, stagingBufferDeviceMemory, 0));
-
-        void* mapping;
-        S_VULKAN(vkMapMemory(g_logicalDevice, stagingBufferDeviceMemory, 0, bufferInfo.size, 0, &mapping));
-        memcpy(mapping, g_indices, bufferInfo.size);
-        vkUnmapMemory(g_logicalDevice, stagingBufferDeviceMemory);
-    }
+    const ArchiveEntry* entry = find_archive_entry(g_assetArchive, "quad.indices");
+    assert(entry && entry->type == ARCHIVE_ENTRY_INDEX_DATA);
 
-    { // create final buffer
-
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(unsigned)*6;
-        bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &g_indexBuffer));
-
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(g_logicalDevice, g_indexBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &g_indexDeviceMemory));
-        S_VULKAN(vkBindBufferMemory(g_logicalDevice, g_indexBuffer, g_indexDeviceMemory, 0));
-    }
-
-    // copy buffer
-    VkCommandBuffer commandBuffer = begin_command_buffer();
-
-    VkBufferCopy copyRegion{};
-    copyRegion.size = sizeof(unsigned)*6;
-    vkCmdCopyBuffer(commandBuffer, stagingBuffer, g_indexBuffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(g_logicalDevice);
-
-    vkFreeCommandBuffers(g_logicalDevice, g_commandPool, 1, &commandBuffer);
+    create_buffer(entry->size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MEMORY_USAGE_STATIC, g_indexBuffer, g_indexAllocation);
+    upload_batch_static_buffer(g_setupUploads, g_indexBuffer, g_indexAllocation, archive_entry_data(g_assetArchive, *entry), entry->size,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 }
 
 static void
 create_texture()
 {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferDeviceMemory;
-    g_imageInfo = VkDescriptorImageInfo{};
-    g_imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    { // create staging buffer
-
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(unsigned char)*16;
-        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        S_VULKAN(vkCreateBuffer(g_logicalDevice, &bufferInfo, nullptr, &stagingBuffer));
-
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(g_logicalDevice, stagingBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &stagingBufferDeviceMemory));
-        S_VULKAN(vkBindBufferMemory(g_logicalDevice, stagingBuffer, stagingBufferDeviceMemory, 0));
-
-        void* mapping;
-        S_VULKAN(vkMapMemory(g_logicalDevice, stagingBufferDeviceMemory, 0, bufferInfo.size, 0, &mapping));
-        memcpy(mapping, g_image, bufferInfo.size);
-        vkUnmapMemory(g_logicalDevice, stagingBufferDeviceMemory);
-    }
-
-    VkImageCreateInfo imageInfo{};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = 2;
-    imageInfo.extent.height = 2;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.flags = 0;
-    S_VULKAN(vkCreateImage(g_logicalDevice, &imageInfo, nullptr, &g_textureImage));
-
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(g_logicalDevice, g_textureImage, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    S_VULKAN(vkAllocateMemory(g_logicalDevice, &allocInfo, nullptr, &g_textureImageMemory));
-    S_VULKAN(vkBindImageMemory(g_logicalDevice, g_textureImage, g_textureImageMemory, 0));
+    const ArchiveEntry* entry = find_archive_entry(g_assetArchive, "quad.texture");
+    assert(entry && entry->type == ARCHIVE_ENTRY_TEXTURE);
+
+    // block compressed entries the device can't sample are decoded to RGBA8 level by level
+    const VkFormat storedFormat = (VkFormat)entry->format;
+    const VkFormat format = texture_format_supported(storedFormat) ? storedFormat : texture_decoded_format(storedFormat);
+    assert(format != VK_FORMAT_UNDEFINED && "texture format not supported by the device");
+
+    // uncompressed entries stored without a mip chain get one, blitted on the gpu
+    // when the format supports linear blits, box filtered on the cpu otherwise
+    const unsigned storedLevels = entry->mipLevels;
+    const bool uncompressed = texture_level_size(format, 1u, 1u) == 4u;
+    const unsigned mipLevels = storedLevels == 1u && uncompressed ? mip_level_count(entry->width, entry->height) : storedLevels;
+    const bool generateOnGpu = mipLevels > storedLevels && texture_format_blittable(format);
+    const unsigned uploadLevels = generateOnGpu ? storedLevels : mipLevels;
+
+    create_image(entry->width, entry->height, mipLevels, format, VK_IMAGE_TILING_OPTIMAL, 
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY,
+        g_textureImage, g_textureImageAllocation);
 
     //-----------------------------------------------------------------------------
     // final image
     //-----------------------------------------------------------------------------
 
+    // decoded and cpu generated levels (always RGBA8)
+    const ArenaMark mark = arena_mark(g_scratchArena);
+    unsigned char* scratch = nullptr;
+    if(format != storedFormat || uploadLevels > storedLevels)
+    {
+        size_t scratchSize = 0u;
+        for(unsigned level = 0; level < uploadLevels; level++)
+            scratchSize += (size_t)(entry->width >> level ? entry->width >> level : 1) * (entry->height >> level ? entry->height >> level : 1) * 4;
+        scratch = (unsigned char*)arena_alloc(g_scratchArena, scratchSize);
+    }
+
     VkImageSubresourceRange subresourceRange = {};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subresourceRange.baseMipLevel = 0;
-    subresourceRange.levelCount = imageInfo.mipLevels;
+    subresourceRange.levelCount = uploadLevels;
     subresourceRange.baseArrayLayer = 0;
     subresourceRange.layerCount = 1;
 
-    VkCommandBuffer commandBuffer = begin_command_buffer();
-    transition_image_layout(commandBuffer, g_textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-    submit_command_buffer(commandBuffer);
-    copy_buffer_to_image(stagingBuffer, g_textureImage, (unsigned)2, (unsigned)2);
-    commandBuffer = begin_command_buffer();
-    transition_image_layout(commandBuffer, g_textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
-    submit_command_buffer(commandBuffer);
-    vkDestroyBuffer(g_logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(g_logicalDevice, stagingBufferDeviceMemory, nullptr);
+    transition_image_layout(g_setupUploads.commandBuffer, g_textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+    const unsigned char* previousLevel = nullptr;
+    size_t scratchOffset = 0u;
+    for(unsigned level = 0; level < uploadLevels; level++)
+    {
+        const unsigned levelWidth = entry->width >> level ? entry->width >> level : 1;
+        const unsigned levelHeight = entry->height >> level ? entry->height >> level : 1;
+        const unsigned char* levelData = nullptr;
+        if(level >= storedLevels)
+        {
+            const unsigned previousWidth = entry->width >> (level - 1) ? entry->width >> (level - 1) : 1;
+            const unsigned previousHeight = entry->height >> (level - 1) ? entry->height >> (level - 1) : 1;
+            levelData = &scratch[scratchOffset];
+            downsample_rgba8(previousLevel, previousWidth, previousHeight, &scratch[scratchOffset]);
+            scratchOffset += (size_t)levelWidth * levelHeight * 4;
+        }
+        else if(format != storedFormat)
+        {
+            levelData = &scratch[scratchOffset];
+            decode_compressed_level(storedFormat, archive_entry_data(g_assetArchive, *entry) + archive_texture_level_offset(*entry, level), levelWidth, levelHeight, &scratch[scratchOffset]);
+            scratchOffset += (size_t)levelWidth * levelHeight * 4;
+        }
+        else
+            levelData = archive_entry_data(g_assetArchive, *entry) + archive_texture_level_offset(*entry, level);
+        upload_batch_image(g_setupUploads, g_textureImage, level, levelWidth, levelHeight, format, levelData);
+        previousLevel = levelData;
+    }
+    arena_rewind(g_scratchArena, mark); // staged by upload_batch_image
 
-    //mvGenerateMipmaps(graphics, texture.textureImage, VK_FORMAT_R8G8B8A8_UNORM, 2, 2, imageInfo.mipLevels);
+    if(generateOnGpu)
+        upload_batch_generate_mips(g_setupUploads, g_textureImage, entry->width, entry->height, mipLevels);
+    else
+        upload_batch_release_image(g_setupUploads, g_textureImage, subresourceRange, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(g_physicalDevice, &properties);
@@ -1893,13 +5507,14 @@ create_texture()
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = g_textureImage;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.format = format;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = imageInfo.mipLevels;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    S_VULKAN(vkCreateImageView(g_logicalDevice, &viewInfo, nullptr, &g_imageInfo.imageView));
+    S_VULKAN(vkCreateImageView(g_logicalDevice, &viewInfo, nullptr, &g_textureImageView));
+    g_textureIndex = texture_table_add(g_textureImageView);
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1917,9 +5532,14 @@ create_texture()
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 1.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    S_VULKAN(vkCreateSampler(g_logicalDevice, &samplerInfo, nullptr, &g_textureSampler));
+    g_drawConstants.samplerIndex = texture_table_add_sampler(g_textureSampler);
+    g_drawConstants.textureIndex = g_textureIndex;
 
-    S_VULKAN(vkCreateSampler(g_logicalDevice, &samplerInfo, nullptr, &g_imageInfo.sampler));
+    // the placeholder above is drawn until this streams in
+    request_texture_stream(g_streamedTexture, S_STREAMED_TEXTURE);
 }
 
 static void
@@ -1958,6 +5578,20 @@ process_events()
                 if(key_sym == XK_S) g_vertexOffset.y_offset -= 0.01f;
                 if(key_sym == XK_A) g_vertexOffset.x_offset -= 0.01f;
                 if(key_sym == XK_D) g_vertexOffset.x_offset += 0.01f;
+                if(key_sym == XK_P && pressed) cycle_present_policy();
+                note_input_event();
+                break;
+            }
+
+            case XCB_CONFIGURE_NOTIFY:
+            {
+                xcb_configure_notify_event_t* configure = (xcb_configure_notify_event_t*)event;
+                if(configure->width != g_width || configure->height != g_height)
+                {
+                    g_width = configure->width;
+                    g_height = configure->height;
+                    g_windowResized = true;
+                }
                 break;
             }
 
@@ -1982,6 +5616,26 @@ process_events()
 static void
 cleanup()
 {
+    {
+        std::lock_guard<std::mutex> lock(g_streamingMutex);
+        g_streamingStop = true;
+    }
+    g_streamingCondition.notify_one();
+    g_streamingThread.join();
+    {
+        std::lock_guard<std::mutex> lock(g_jobMutex);
+        g_jobStop = true;
+    }
+    g_jobCondition.notify_all();
+    for(unsigned i = 1; i < g_jobThreadCount; i++)
+        g_jobThreads[i].join();
+    unmap_file(g_assetArchive.file);
+    for(unsigned i = 0; i < g_framesInFlight; i++)
+        arena_free(g_frameContexts[i].arena);
+    arena_free(g_scratchArena);
+    arena_free(g_swapChainArena);
+    arena_free(g_setupArena);
+
 #ifdef _WIN32
 #elif defined(__APPLE__)
 #else // linux
@@ -1995,25 +5649,163 @@ cleanup()
 // [SECTION] general per-frame function implementations
 //-----------------------------------------------------------------------------
 
+#if S_LOG_FRAME_TIMES
+// blocked is the time spent waiting for the frame's timeline value, pacing, the image and its
+// value, i.e. on the gpu and presentation. More frames in flight should trade it for latency.
+static void
+log_frame_time(double blocked)
+{
+    static double windowBegin = get_time_ms();
+    static double totalBlocked = 0.0;
+    static unsigned frameCount = 0u;
+
+    totalBlocked += blocked;
+    if(++frameCount < S_FRAME_TIME_WINDOW)
+        return;
+
+    const double now = get_time_ms();
+    printf("%u frames in flight: %.3f ms per frame, %.3f ms blocked\n", g_framesInFlight, (now - windowBegin) / frameCount, totalBlocked / frameCount);
+    windowBegin = now;
+    totalBlocked = 0.0;
+    frameCount = 0u;
+}
+#endif
+
+static void
+note_input_event()
+{
+    if(g_pendingInputTime == 0.0)
+        g_pendingInputTime = get_time_ms();
+}
+
+// holds the cpu back until the frame g_presentLatency frames before this one has been
+// presented, so input is sampled as late as possible. Without present wait, the gpu being
+// done with that frame stands in for it, which leaves out the time spent queued for display.
+// Latency is taken when the wait returns, exact as long as the cpu had to wait.
 static void
+pace_frame()
+{
+    const uint64_t presentId = g_graphicsTimeline.value + 1u; // this frame's, see submit_command_buffers_then_present
+    if(g_presentLatency == 0u || presentId < g_swapChainFirstPresentId + g_presentLatency)
+        return;
+    const uint64_t pacedId = presentId - g_presentLatency;
+    if(pacedId <= g_pacedPresentId)
+        return; // frame started over, the swapchain was out of date
+    g_pacedPresentId = pacedId;
+
+    bool presented = true;
+    if(g_presentWaitSupported)
+    {
+        const VkResult result = g_vkWaitForPresentKHR(g_logicalDevice, g_swapChain, pacedId, S_PRESENT_WAIT_TIMEOUT);
+        if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+            g_swapChainOutOfDate = true;
+        else
+            assert(result == VK_SUCCESS || result == VK_TIMEOUT);
+        presented = result == VK_SUCCESS;
+    }
+    else
+        timeline_wait(g_graphicsTimeline, pacedId);
+
+#if S_LOG_INPUT_LATENCY
+    const double inputTime = g_presentInputTimes[pacedId % S_MAX_PRESENT_LATENCY];
+    if(inputTime != 0.0 && presented)
+        printf("input to photon: %.2f ms (frame %llu%s)\n", get_time_ms() - inputTime, (unsigned long long)pacedId,
+            g_presentWaitSupported ? "" : ", gpu done, display not included");
+#endif
+}
+
+static bool
 begin_frame()
 {
-    S_VULKAN(vkWaitForFences(g_logicalDevice, 1, &g_inFlightFences[g_currentFrame], VK_TRUE, UINT64_MAX));
-    S_VULKAN(vkAcquireNextImageKHR(g_logicalDevice, g_swapChain, UINT64_MAX, g_imageAvailableSemaphores[g_currentFrame],VK_NULL_HANDLE, &g_currentImageIndex));
-    if (g_imagesInFlight[g_currentImageIndex] != VK_NULL_HANDLE)
-        S_VULKAN(vkWaitForFences(g_logicalDevice, 1, &g_imagesInFlight[g_currentImageIndex], VK_TRUE, UINT64_MAX));
+    FrameContext& frame = g_frameContexts[g_currentFrame];
+#if S_LOG_FRAME_TIMES
+    double blockedBegin = get_time_ms();
+#endif
+    timeline_wait(g_graphicsTimeline, frame.timelineValue);
+    pace_frame();
+#if S_LOG_FRAME_TIMES
+    double blocked = get_time_ms() - blockedBegin;
+#endif
+    retire_submissions();
+    process_deferred_destruction();
+    uniform_arena_begin_frame();
+    arena_reset(frame.arena); // the frame's previous batches are submitted
+    S_VULKAN(vkResetCommandPool(g_logicalDevice, frame.commandPool, 0));
+
+    frame.waits.count = 0u;
+    push_semaphore_wait(frame.waits, frame.imageAvailable, 0u, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+#if S_LOG_FRAME_TIMES
+    blockedBegin = get_time_ms();
+#endif
+    const VkResult result = vkAcquireNextImageKHR(g_logicalDevice, g_swapChain, UINT64_MAX, frame.imageAvailable, VK_NULL_HANDLE, &g_currentImageIndex);
+    if(result == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // nothing was signaled, the frame starts over once the swapchain is recreated
+        g_swapChainOutOfDate = true;
+        return false;
+    }
+    assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+    if(result == VK_SUBOPTIMAL_KHR)
+        g_swapChainOutOfDate = true; // still presentable, recreated after this frame
 
     // just in case the acquired image is out of order
-    g_imagesInFlight[g_currentImageIndex] = g_inFlightFences[g_currentFrame];
+    timeline_wait(g_graphicsTimeline, g_imageTimelineValues[g_currentImageIndex]);
+#if S_LOG_FRAME_TIMES
+    log_frame_time(blocked + get_time_ms() - blockedBegin);
+#endif
+    return true;
 }
 
 static void
 begin_recording()
 {
+    FrameContext& frame = g_frameContexts[g_currentFrame];
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    S_VULKAN(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+    acquire_pending_uploads(frame.commandBuffer, frame.waits);
+}
+
+//-----------------------------------------------------------------------------
+
+// one texture per frame while a heap is over its high watermark, least recently used
+// first: textures unused for S_RESIDENCY_IDLE_FRAMES are evicted, the ones still drawn
+// lose their most detailed level. Released memory counts as soon as it is deferred.
+static void
+update_residency()
+{
+    residency_query_budgets();
+
+    for(unsigned heap = 0; heap < g_memoryProperties.memoryHeapCount; heap++)
+    {
+        if(residency_fits(heap, 0u))
+            continue;
+
+        StreamedTexture* victim = nullptr;
+        for(unsigned i = 0; i < g_residentTextureCount; i++)
+        {
+            StreamedTexture* texture = g_residentTextures[i];
+            if(texture->state != STREAM_STATE_RESIDENT || g_memoryProperties.memoryTypes[texture->allocation.memoryType].heapIndex != heap)
+                continue;
+            const bool idle = texture->lastUsedFrame + S_RESIDENCY_IDLE_FRAMES <= g_frameIndex;
+            if(!idle && texture->mipLevels == 1u)
+                continue;
+            if(victim == nullptr || texture->lastUsedFrame < victim->lastUsedFrame ||
+                (texture->lastUsedFrame == victim->lastUsedFrame && texture->allocation.size > victim->allocation.size))
+                victim = texture;
+        }
 
-    S_VULKAN(vkBeginCommandBuffer(g_commandBuffers[g_currentImageIndex], &beginInfo));
+        if(victim == nullptr)
+            continue;
+        if(victim->lastUsedFrame + S_RESIDENCY_IDLE_FRAMES <= g_frameIndex)
+            evict_streamed_texture(*victim);
+        else
+            demote_streamed_texture(*victim, g_frameContexts[g_currentFrame].commandBuffer);
+        return;
+    }
 }
 
 static void
@@ -2035,55 +5827,127 @@ begin_render_pass()
     renderPassInfo.clearValueCount = 2;
     renderPassInfo.pClearValues = clearValues;
 
-    vkCmdBeginRenderPass(g_commandBuffers[g_currentImageIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(g_frameContexts[g_currentFrame].commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 }
 
+// job recording its share of the draws into its secondary command buffer for the current
+// frame (state isn't inherited, so every buffer binds its own)
 static void
-set_viewport_settings()
+record_draw_range(void* data, unsigned recorder)
 {
-    VkRect2D scissor{};
-    scissor.extent = g_swapChainExtent;
+    RecordingContext& context = g_frameContexts[g_currentFrame].recordingContexts[recorder];
+    S_VULKAN(vkResetCommandPool(g_logicalDevice, context.commandPool, 0));
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = g_renderPass;
+    inheritanceInfo.subpass = 0u;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+#if S_STATIC_COMMAND_BUFFERS
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT; // replayed with whichever image is acquired
+#else
+    inheritanceInfo.framebuffer = g_swapChainFramebuffers[g_currentImageIndex];
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+#endif
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    S_VULKAN(vkBeginCommandBuffer(context.commandBuffer, &beginInfo));
+
+    const unsigned drawsPerRecorder = (S_DRAW_COUNT + g_recorderCount - 1u) / g_recorderCount;
+    const unsigned firstDraw = recorder * drawsPerRecorder;
+    if(firstDraw < S_DRAW_COUNT)
+    {
+        set_viewport_settings(context.commandBuffer);
+        setup_pipeline_state(context.commandBuffer);
+        draw(context.commandBuffer, firstDraw, get_min(drawsPerRecorder, S_DRAW_COUNT - firstDraw));
+    }
+    S_VULKAN(vkEndCommandBuffer(context.commandBuffer));
+}
+
+// splits the draws over as many jobs as keep the job threads busy, the main thread helps
+// recording and then joins the secondary command buffers into the primary one. With
+// S_STATIC_COMMAND_BUFFERS, a frame in flight replays the buffers it recorded last time
+// until they are invalidated or the dynamic offset they bind moved.
+static void
+record_render_pass_contents()
+{
+    FrameContext& frame = g_frameContexts[g_currentFrame];
+    RenderPassContents& contents = frame.renderPassContents;
+#if S_STATIC_COMMAND_BUFFERS
+    if(contents.recorderCount == 0u || contents.dynamicOffset != g_vertexOffsetDynamicOffset)
+#endif
+    {
+        g_recorderCount = get_max(1u, get_min(g_jobThreadCount, (S_DRAW_COUNT + S_MIN_DRAWS_PER_RECORDER - 1u) / S_MIN_DRAWS_PER_RECORDER));
+        JobCounter counter;
+        run_jobs(record_draw_range, nullptr, g_recorderCount, counter);
+        wait_for_counter(counter);
+        contents.recorderCount = g_recorderCount;
+        contents.dynamicOffset = g_vertexOffsetDynamicOffset;
+    }
+
+    VkCommandBuffer secondaryCommandBuffers[S_MAX_JOB_THREADS];
+    for(unsigned i = 0; i < contents.recorderCount; i++)
+        secondaryCommandBuffers[i] = frame.recordingContexts[i].commandBuffer;
+    vkCmdExecuteCommands(frame.commandBuffer, contents.recorderCount, secondaryCommandBuffers);
+}
 
-    g_viewport.x = 0.0f;
-    g_viewport.y = g_swapChainExtent.height;
-    g_viewport.width = g_swapChainExtent.width;
-    g_viewport.height = -(int)g_swapChainExtent.height;
+static void
+invalidate_render_pass_contents(unsigned frame)
+{
+    g_frameContexts[frame].renderPassContents.recorderCount = 0u;
+}
 
-    vkCmdSetViewport(g_commandBuffers[g_currentImageIndex], 0, 1, &g_viewport);
-    vkCmdSetScissor(g_commandBuffers[g_currentImageIndex], 0, 1, &scissor);  
+static void
+cycle_present_policy()
+{
+    g_presentPolicy = (PresentPolicy)((g_presentPolicy + 1) % PRESENT_POLICY_COUNT);
+    g_presentPolicyChanged = true;
 }
 
 static void
 end_render_pass()
 {
-    vkCmdEndRenderPass(g_commandBuffers[g_currentImageIndex]);
+    vkCmdEndRenderPass(g_frameContexts[g_currentFrame].commandBuffer);
 }
 
 static void
 end_recording()
 {
-    S_VULKAN(vkEndCommandBuffer(g_commandBuffers[g_currentImageIndex]));
+    S_VULKAN(vkEndCommandBuffer(g_frameContexts[g_currentFrame].commandBuffer));
 }
 
 static void
 submit_command_buffers_then_present()
 {
-    VkSemaphore waitSemaphores[] = { g_imageAvailableSemaphores[g_currentFrame] };
-    VkSemaphore signalSemaphores[] = { g_renderFinishedSemaphores[g_currentFrame] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    // image available + uploads acquired this frame
+    FrameContext& frame = g_frameContexts[g_currentFrame];
+    frame.timelineValue = ++g_graphicsTimeline.value;
+    g_imageTimelineValues[g_currentImageIndex] = frame.timelineValue;
+    VkSemaphore signalSemaphores[] = { frame.renderFinished, g_graphicsTimeline.semaphore };
+    const uint64_t signalValues[] = { 0u, frame.timelineValue }; // binary semaphores ignore theirs
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = frame.waits.count;
+    timelineInfo.pWaitSemaphoreValues = frame.waits.values;
+    timelineInfo.signalSemaphoreValueCount = 2;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = frame.waits.count;
+    submitInfo.pWaitSemaphores = frame.waits.semaphores;
+    submitInfo.pWaitDstStageMask = frame.waits.stageMasks;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &g_commandBuffers[g_currentImageIndex];
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    submitInfo.signalSemaphoreCount = 2;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    S_VULKAN(vkResetFences(g_logicalDevice, 1, &g_inFlightFences[g_currentFrame]));
-    S_VULKAN(vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, g_inFlightFences[g_currentFrame]));   
+    uniform_arena_flush();
+    S_VULKAN(vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));   
+    staging_ring_retire(g_graphicsTimeline, frame.timelineValue); // staging used by this frame
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -2093,8 +5957,24 @@ submit_command_buffers_then_present()
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = &g_currentImageIndex;
+
+    // frames count up on the graphics timeline, its value doubles as the present id
+    VkPresentIdKHR presentId{};
+    presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    presentId.swapchainCount = 1;
+    presentId.pPresentIds = &frame.timelineValue;
+    if(g_presentWaitSupported)
+        presentInfo.pNext = &presentId;
+    g_presentInputTimes[frame.timelineValue % S_MAX_PRESENT_LATENCY] = g_pendingInputTime;
+    g_pendingInputTime = 0.0;
+
     VkResult result = vkQueuePresentKHR(g_presentQueue, &presentInfo);
+    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        g_swapChainOutOfDate = true;
+    else
+        S_VULKAN(result);
     g_currentFrame = (g_currentFrame + 1) % g_framesInFlight;
+    g_frameIndex++;
 }
 
 //-----------------------------------------------------------------------------
@@ -2104,31 +5984,86 @@ submit_command_buffers_then_present()
 static void
 update_descriptor_sets()
 {
-    VkWriteDescriptorSet descriptorWrites[1];
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstBinding = 0u;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].dstSet = g_descriptorSets[g_currentImageIndex];
-    descriptorWrites[0].pImageInfo = &g_imageInfo; 
-    descriptorWrites[0].pNext = nullptr;
-    vkUpdateDescriptorSets(g_logicalDevice, 1, descriptorWrites, 0, nullptr);
+    // swap to the streamed texture as soon as its smallest levels are resident, back to
+    // the placeholder if it was evicted (and stream it in again)
+    g_streamedTexture.lastUsedFrame = g_frameIndex;
+    if(g_streamedTexture.state == STREAM_STATE_EVICTED)
+        request_texture_stream(g_streamedTexture, g_streamedTexture.path);
+    update_streamed_texture(g_streamedTexture);
+
+    // the index is pushed by every recorded draw, and the old slot is reused once this frame
+    // is done, so no frame may replay contents recorded with it
+    const unsigned textureIndex = g_streamedTexture.view != VK_NULL_HANDLE ? g_streamedTexture.textureIndex : g_textureIndex;
+    if(textureIndex != g_drawConstants.textureIndex)
+    {
+        g_drawConstants.textureIndex = textureIndex;
+        for(unsigned i = 0; i < g_framesInFlight; i++)
+            invalidate_render_pass_contents(i);
+    }
+
+    FrameDescriptors frameDescriptors;
+    memset(&frameDescriptors, 0, sizeof(frameDescriptors)); // padding is hashed too
+    frameDescriptors.constants.buffer = g_uniformArena.buffer;
+    frameDescriptors.constants.range = sizeof(ConstantBuffer);
+
+    // unchanged contents cost a hash. Rewriting or switching sets invalidates the command buffers binding them.
+    bool written = false;
+    const VkDescriptorSet set = descriptor_cache_get(g_frameContexts[g_currentFrame], g_descriptorSetLayout, g_descriptorUpdateTemplate, &frameDescriptors, sizeof(frameDescriptors), written);
+    if(written || set != g_descriptorSets[g_currentFrame])
+        invalidate_render_pass_contents(g_currentFrame);
+    g_descriptorSets[g_currentFrame] = set;
+}
+
+static void
+update_constant_buffers()
+{
+    g_vertexOffsetDynamicOffset = uniform_arena_push(&g_vertexOffset, sizeof(ConstantBuffer));
 }
 
 static void
-setup_pipeline_state()
+set_viewport_settings(VkCommandBuffer commandBuffer)
 {
-    static VkDeviceSize offsets = { 0 };
-    vkCmdSetDepthBias(g_commandBuffers[g_currentImageIndex], 0.0f, 0.0f, 0.0f);
-    vkCmdBindPipeline(g_commandBuffers[g_currentImageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipeline);
-    vkCmdBindDescriptorSets(g_commandBuffers[g_currentImageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipelineLayout, 0, 1, &g_descriptorSets[g_currentImageIndex], 0u, nullptr);
-    vkCmdBindIndexBuffer(g_commandBuffers[g_currentImageIndex], g_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdBindVertexBuffers(g_commandBuffers[g_currentImageIndex], 0, 1, &g_vertexBuffer, &offsets);
+    VkRect2D scissor{};
+    scissor.extent = g_swapChainExtent;
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = g_swapChainExtent.height;
+    viewport.width = g_swapChainExtent.width;
+    viewport.height = -(int)g_swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
+// called from every recording thread, only reads state set up before recording starts
 static void
-draw()
+setup_pipeline_state(VkCommandBuffer commandBuffer)
 {
-    vkCmdDrawIndexed(g_commandBuffers[g_currentImageIndex], 6, 1, 0, 0, 0);
+    static const VkDeviceSize offsets = { 0 };
+    vkCmdSetDepthBias(commandBuffer, 0.0f, 0.0f, 0.0f);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipeline);
+    const VkDescriptorSet descriptorSets[2] = { g_textureTable.set, g_descriptorSets[g_currentFrame] };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipelineLayout, 0, 2, descriptorSets, 1u, &g_vertexOffsetDynamicOffset);
+    vkCmdBindIndexBuffer(commandBuffer, g_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &g_vertexBuffer, &offsets);
+}
+
+// materials are indices into g_textureTable, so draws only push constants, they never bind sets
+static void
+draw(VkCommandBuffer commandBuffer, unsigned firstDraw, unsigned drawCount)
+{
+    DrawConstants pushed = { ~0u, ~0u };
+    for(unsigned i = firstDraw; i < firstDraw + drawCount; i++)
+    {
+        const DrawConstants& constants = g_drawConstants; // every copy of the quad shares its material
+        if(constants.textureIndex != pushed.textureIndex || constants.samplerIndex != pushed.samplerIndex)
+        {
+            vkCmdPushConstants(commandBuffer, g_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0u, sizeof(DrawConstants), &constants);
+            pushed = constants;
+        }
+        vkCmdDrawIndexed(commandBuffer, 6, 1, 0, 0, 0);
+    }
 }
@@ -6,9 +6,17 @@ layout(location = 1) in vec2 inUV;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 0, binding = 0) uniform sampler2D colorSampler;
+// texture table, sizes are S_TEXTURE_TABLE_SIZE and S_TEXTURE_TABLE_SAMPLERS
+layout(set = 0, binding = 0) uniform texture2D textures[1024];
+layout(set = 0, binding = 1) uniform sampler samplers[16];
+
+layout(push_constant) uniform DrawConstants
+{
+    uint textureIndex;
+    uint samplerIndex;
+} draw;
 
 void main() 
 {
-    outColor = texture(colorSampler, inUV);
+    outColor = texture(sampler2D(textures[draw.textureIndex], samplers[draw.samplerIndex]), inUV);
 }
\ No newline at end of file
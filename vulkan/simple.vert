@@ -6,9 +6,15 @@ layout(location = 1) in vec2 uv;
 layout(location = 0) out vec2 outPos;
 layout(location = 1) out vec2 outUV;
 
+layout(set = 1, binding = 0) uniform ConstantBuffer
+{
+    float x_offset;
+    float y_offset;
+} cb;
+
 void main() 
 {
-    gl_Position = vec4(pos, 0.0, 1.0);
+    gl_Position = vec4(pos.x + cb.x_offset, pos.y + cb.y_offset, 0.0, 1.0);
     outPos = gl_Position.xy;
     outUV = uv;
 }
\ No newline at end of file